@@ -0,0 +1,187 @@
+/*
+ * Disk cache of baked attribute samples.
+ *
+ * Each baked plug is stored in its own file, named after the plug, the
+ * frame range, and a hash of the scene file and time unit, so repeated
+ * matches of the same attribute skip the (slow) DG evaluation. The
+ * file header repeats the whole key and is checked when read. The
+ * cache is not invalidated when the scene is edited; delete the files
+ * (or use another directory) to re-bake.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_CACHE_H
+#define MAYA_ANIM_CURVE_MATCH_CACHE_H
+
+// STL
+#include <cctype>    // isalnum
+#include <cstdio>    // snprintf
+#include <cstring>   // memcmp
+#include <fstream>   // ifstream, ofstream
+#include <string>    // string
+#include <vector>    // vector
+
+// Utils
+#include <animCurveMatchCurve.h>
+
+
+// File header, followed by the version number.
+const char kBakeCacheMagic[4] = {'A', 'C', 'M', 'B'};
+const int kBakeCacheVersion = 1;
+
+// Longest string stored in a cache header.
+const unsigned int kMaxBakeCacheString = 4096;
+
+
+// What a cache file was baked from; a file is only used when all of
+// the key matches.
+struct BakeCacheKey {
+    BakeCacheKey() :
+            startFrame(0.0),
+            endFrame(0.0),
+            framesPerSecond(24.0) {}
+
+    std::string sceneFile;
+    std::string plugName;
+    double startFrame;
+    double endFrame;
+
+    // Time unit the frames are in.
+    double framesPerSecond;
+};
+
+
+// Number of whole frames baked from 'startFrame' to 'endFrame'.
+inline
+int bakeFrameCount(double startFrame, double endFrame) {
+    return int(endFrame - startFrame) + 1;
+}
+
+
+// Path of the cache file of 'key'. Characters that are not valid in
+// file names are replaced, and the scene file and time unit are hashed
+// (FNV-1a) into the name.
+inline
+std::string bakeCachePath(const std::string &cacheDir, const BakeCacheKey &key) {
+    std::string name;
+    for (size_t i = 0; i < key.plugName.size(); ++i) {
+        char c = key.plugName[i];
+        name += std::isalnum((unsigned char) c) ? c : '_';
+    }
+
+    char fps[32];
+    snprintf(fps, sizeof(fps), "%g", key.framesPerSecond);
+    std::string hashed = key.sceneFile + "@" + fps;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < hashed.size(); ++i) {
+        hash = (hash ^ (unsigned char) hashed[i]) * 16777619u;
+    }
+    char suffix[96];
+    snprintf(suffix, sizeof(suffix), "_%g_%g_%08x.bake", key.startFrame, key.endFrame, hash);
+
+    std::string path = cacheDir;
+    if (!path.empty() && (path[path.size() - 1] != '/')) {
+        path += '/';
+    }
+    return path + name + suffix;
+}
+
+
+inline
+bool readBakeCacheString(std::ifstream &file, std::string &value) {
+    unsigned int length = 0;
+    file.read((char *) &length, sizeof(length));
+    if (!file || (length > kMaxBakeCacheString)) {
+        return false;
+    }
+    value.assign(length, '\0');
+    if (length > 0) {
+        file.read(&value[0], length);
+    }
+    return (bool) file;
+}
+
+
+inline
+void writeBakeCacheString(std::ofstream &file, const std::string &value) {
+    unsigned int length = (unsigned int) value.size();
+    file.write((const char *) &length, sizeof(length));
+    file.write(value.data(), length);
+}
+
+
+// Read baked samples from 'path'. Returns false if the file does not
+// exist, was baked with another key, or does not hold one sample per
+// frame of the key's range.
+inline
+bool readBakeCache(const std::string &path,
+                   const BakeCacheKey &key,
+                   CurveSamples &samples) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    int version = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char *) &version, sizeof(version));
+    if (!file || (memcmp(magic, kBakeCacheMagic, sizeof(magic)) != 0)
+        || (version != kBakeCacheVersion)) {
+        return false;
+    }
+    BakeCacheKey fileKey;
+    unsigned int num = 0;
+    if (!readBakeCacheString(file, fileKey.sceneFile)
+        || !readBakeCacheString(file, fileKey.plugName)) {
+        return false;
+    }
+    file.read((char *) &fileKey.startFrame, sizeof(fileKey.startFrame));
+    file.read((char *) &fileKey.endFrame, sizeof(fileKey.endFrame));
+    file.read((char *) &fileKey.framesPerSecond, sizeof(fileKey.framesPerSecond));
+    file.read((char *) &num, sizeof(num));
+    if (!file || (fileKey.sceneFile != key.sceneFile) || (fileKey.plugName != key.plugName)
+        || (fileKey.startFrame != key.startFrame) || (fileKey.endFrame != key.endFrame)
+        || (fileKey.framesPerSecond != key.framesPerSecond)) {
+        return false;
+    }
+    int numFrames = bakeFrameCount(key.startFrame, key.endFrame);
+    if ((numFrames < 2) || (num != (unsigned int) numFrames)) {
+        return false;
+    }
+
+    samples.times.resize(num);
+    samples.values.resize(num);
+    file.read((char *) &samples.times[0], num * sizeof(double));
+    file.read((char *) &samples.values[0], num * sizeof(double));
+    return (bool) file;
+}
+
+
+// Write baked samples to 'path'. Returns false if the file could not
+// be written.
+inline
+bool writeBakeCache(const std::string &path,
+                    const BakeCacheKey &key,
+                    const CurveSamples &samples) {
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    unsigned int num = samples.numSamples();
+    file.write(kBakeCacheMagic, sizeof(kBakeCacheMagic));
+    file.write((const char *) &kBakeCacheVersion, sizeof(kBakeCacheVersion));
+    writeBakeCacheString(file, key.sceneFile);
+    writeBakeCacheString(file, key.plugName);
+    file.write((const char *) &key.startFrame, sizeof(key.startFrame));
+    file.write((const char *) &key.endFrame, sizeof(key.endFrame));
+    file.write((const char *) &key.framesPerSecond, sizeof(key.framesPerSecond));
+    file.write((const char *) &num, sizeof(num));
+    if (num > 0) {
+        file.write((const char *) &samples.times[0], num * sizeof(double));
+        file.write((const char *) &samples.values[0], num * sizeof(double));
+    }
+    return (bool) file;
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_CACHE_H
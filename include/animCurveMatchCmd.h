@@ -28,6 +28,8 @@
 #include <maya/MVector.h>
 #include <maya/MMatrix.h>
 #include <maya/MString.h>
+#include <maya/MIntArray.h>
+#include <maya/MStringArray.h>
 
 // Command arguments and command name
 #define kNameFlag          "-n"
@@ -69,6 +71,116 @@
 #define kNewCurveFlagLong      "-newCurve"
 #define kNewCurveDefaultValue  false
 
+#define kReduceFlag          "-rd"
+#define kReduceFlagLong      "-reduce"
+#define kReduceDefaultValue  false
+
+#define kToleranceFlag          "-tol"
+#define kToleranceFlagLong      "-tolerance"
+#define kToleranceDefaultValue  0.01
+
+#define kSweepFlag          "-sw"
+#define kSweepFlagLong      "-sweep"
+#define kSweepDefaultValue  false
+
+#define kMinKeysFlag          "-mnk"
+#define kMinKeysFlagLong      "-minKeys"
+#define kMinKeysDefaultValue  2
+
+#define kMaxKeysFlag          "-mxk"
+#define kMaxKeysFlagLong      "-maxKeys"
+#define kMaxKeysDefaultValue  32
+
+#define kRestartsFlag          "-rs"
+#define kRestartsFlagLong      "-restarts"
+#define kRestartsDefaultValue  4
+
+#define kDirectSolveFlag          "-ds"
+#define kDirectSolveFlagLong      "-directSolve"
+#define kDirectSolveDefaultValue  true
+
+#define kPolishIterationsFlag          "-pi"
+#define kPolishIterationsFlagLong      "-polishIterations"
+#define kPolishIterationsDefaultValue  0
+
+#define kStreamedFlag          "-str"
+#define kStreamedFlagLong      "-streamed"
+#define kStreamedDefaultValue  false
+
+#define kTimeBudgetFlag          "-tb"
+#define kTimeBudgetFlagLong      "-timeBudget"
+#define kTimeBudgetDefaultValue  0.0
+
+#define kTargetRmsErrorFlag          "-tre"
+#define kTargetRmsErrorFlagLong      "-targetRmsError"
+#define kTargetRmsErrorDefaultValue  0.0
+
+#define kTargetMaxErrorFlag          "-tme"
+#define kTargetMaxErrorFlagLong      "-targetMaxError"
+#define kTargetMaxErrorDefaultValue  0.0
+
+#define kErrorReportFlag          "-er"
+#define kErrorReportFlagLong      "-errorReport"
+#define kErrorReportDefaultValue  false
+
+#define kCovarianceFlag          "-cv"
+#define kCovarianceFlagLong      "-covariance"
+#define kCovarianceDefaultValue  false
+
+#define kBakeOnlyFlag          "-bo"
+#define kBakeOnlyFlagLong      "-bakeOnly"
+#define kBakeOnlyDefaultValue  false
+
+#define kStartFrameFlag          "-sf"
+#define kStartFrameFlagLong      "-startFrame"
+
+#define kEndFrameFlag          "-ef"
+#define kEndFrameFlagLong      "-endFrame"
+
+#define kCacheDirFlag          "-cd"
+#define kCacheDirFlagLong      "-cacheDir"
+
+#define kIncrementalFlag          "-inc"
+#define kIncrementalFlagLong      "-incremental"
+#define kIncrementalDefaultValue  false
+
+#define kChangedKeysFlag          "-ck"
+#define kChangedKeysFlagLong      "-changedKeys"
+
+#define kNeighbourhoodFlag          "-nh"
+#define kNeighbourhoodFlagLong      "-neighbourhood"
+#define kNeighbourhoodDefaultValue  1
+
+#define kAsyncFlag          "-asy"
+#define kAsyncFlagLong      "-asynchronous"
+#define kAsyncDefaultValue  false
+
+#define kDryRunFlag          "-dr"
+#define kDryRunFlagLong      "-dryRun"
+#define kDryRunDefaultValue  false
+
+#define kExportJobFlag          "-ej"
+#define kExportJobFlagLong      "-exportJob"
+
+#define kImportResultsFlag          "-ir"
+#define kImportResultsFlagLong      "-importResults"
+
+#define kJobStatusFlag          "-js"
+#define kJobStatusFlagLong      "-jobStatus"
+
+#define kCancelJobFlag          "-cj"
+#define kCancelJobFlagLong      "-cancelJob"
+
+#define kApplyJobFlag          "-aj"
+#define kApplyJobFlagLong      "-applyJob"
+
+#define kTraceFileFlag          "-tf"
+#define kTraceFileFlagLong      "-traceFile"
+
+#define kVerbosityFlag          "-vb"
+#define kVerbosityFlagLong      "-verbosity"
+#define kVerbosityDefaultValue  0
+
 #define kCommandName "animCurveMatch"
 
 
@@ -95,7 +207,14 @@ public:
 private:
     MStatus parseArgs( const MArgList& args );
 
+    MStatus doJobCommand();
+
+    MStatus doBakeCommand();
+
+    MStatus doImportCommand();
+
     MString m_srcCurveName;
+    MString m_srcPlugName;
     MString m_dstCurveName;
     MAnimCurveChange m_animChange;
 
@@ -109,6 +228,39 @@ private:
     bool m_forceWholeFrames;
     bool m_addKeys;
     bool m_createNewCurve;
+    bool m_reduce;
+    double m_tolerance;
+    bool m_sweep;
+    unsigned int m_minKeys;
+    unsigned int m_maxKeys;
+    unsigned int m_restarts;
+    bool m_directSolve;
+    unsigned int m_polishIterations;
+    bool m_streamed;
+    double m_timeBudget;
+    double m_targetRmsError;
+    double m_targetMaxError;
+    bool m_errorReport;
+    bool m_covariance;
+    bool m_bakeOnly;
+    MStringArray m_bakePlugNames;
+    double m_startFrame;
+    double m_endFrame;
+    MString m_cacheDir;
+    bool m_incremental;
+    MIntArray m_changedKeys;
+    unsigned int m_neighbourhood;
+    MString m_traceFile;
+    bool m_async;
+    bool m_dryRun;
+    MString m_exportJob;
+    MString m_importResults;
+    bool m_jobStatus;
+    bool m_cancelJob;
+    bool m_applyJob;
+    unsigned int m_jobId;
+    bool m_isUndoable;
+    unsigned int m_verbosity;
 };
 
 #endif // MAYA_ANIM_CURVE_MATCH_CMD_H
@@ -0,0 +1,406 @@
+/*
+ * Maya independent animCurve keyframe data and evaluation.
+ *
+ * A 'CurveKeys' is a snapshot of an animCurve's keyframes, so the
+ * solver can evaluate curves without calling the Maya API, and
+ * therefore from any thread.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_CURVE_H
+#define MAYA_ANIM_CURVE_MATCH_CURVE_H
+
+// STL
+#include <cmath>      // tan, atan, sin, cos, fabs, floor, ceil, fmod
+#include <vector>     // vector
+#include <limits>     // numeric_limits
+#include <algorithm>  // upper_bound, copy, min, max
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+// Smallest distance allowed between two keyframe times (in frames).
+const double kMinKeySpacing = 1.0e-3;
+
+// Curve extrapolation before the first and after the last keyframe.
+// Values match MFnAnimCurve::InfinityType.
+enum CurveInfinity {
+    kInfinityConstant = 0,
+    kInfinityLinear = 1,
+    kInfinityCycle = 3,
+    kInfinityCycleRelative = 4,
+    kInfinityOscillate = 5
+};
+
+
+// Does the infinity type repeat the curve?
+inline
+bool isCyclicInfinity(int infinity) {
+    return (infinity == kInfinityCycle)
+           || (infinity == kInfinityCycleRelative)
+           || (infinity == kInfinityOscillate);
+}
+
+
+struct CurveKeys {
+    // Keyframes, sorted by time. Times are in Maya UI units (frames).
+    std::vector<double> times;
+    std::vector<double> values;
+
+    // Tangent angles (degrees) and weights. Like MFnAnimCurve, a
+    // tangent is weight * (cos(angle), sin(angle)) in seconds and
+    // value; weights are only used by weighted curves.
+    std::vector<double> inAngles;
+    std::vector<double> outAngles;
+    std::vector<double> inWeights;
+    std::vector<double> outWeights;
+
+    int preInfinity;
+    int postInfinity;
+
+    // Weighted curves are Bezier segments shaped by the tangent
+    // weights, otherwise segments are Hermite and weights are ignored.
+    bool weighted;
+
+    // Number of UI time units per second, tangent angles are
+    // measured in value per second.
+    double framesPerSecond;
+
+    CurveKeys() :
+            preInfinity(kInfinityConstant),
+            postInfinity(kInfinityConstant),
+            weighted(false),
+            framesPerSecond(24.0) {}
+
+    unsigned int numKeys() const {
+        return (unsigned int) times.size();
+    }
+
+    void resize(unsigned int num) {
+        times.resize(num, 0.0);
+        values.resize(num, 0.0);
+        inAngles.resize(num, 0.0);
+        outAngles.resize(num, 0.0);
+        inWeights.resize(num, 1.0);
+        outWeights.resize(num, 1.0);
+    }
+};
+
+
+// Values sampled at increasing times, for example a baked attribute.
+struct CurveSamples {
+    std::vector<double> times;
+    std::vector<double> values;
+
+    unsigned int numSamples() const {
+        return (unsigned int) times.size();
+    }
+};
+
+
+// Convert between tangent angles (degrees) and slopes (value per frame).
+inline
+double angleToSlope(double angle, double framesPerSecond) {
+    return std::tan(angle * (M_PI / 180.0)) / framesPerSecond;
+}
+
+inline
+double slopeToAngle(double slope, double framesPerSecond) {
+    return std::atan(slope * framesPerSecond) * (180.0 / M_PI);
+}
+
+
+// Keep keyframe times strictly increasing, after times were modified.
+// Returns the last keyframe moved, or -1 if none were.
+inline
+int sortCurveKeyTimes(CurveKeys &keys) {
+    int lastMoved = -1;
+    for (unsigned int i = 1; i < keys.numKeys(); ++i) {
+        if (keys.times[i] < (keys.times[i - 1] + kMinKeySpacing)) {
+            keys.times[i] = keys.times[i - 1] + kMinKeySpacing;
+            lastMoved = (int) i;
+        }
+    }
+    return lastMoved;
+}
+
+
+// Round a time (in frames) to the nearest whole frame.
+inline
+double roundToFrame(double t) {
+    return std::floor(t + 0.5);
+}
+
+
+// Round the times of keyframes 'firstKey' to 'lastKey' to whole
+// frames. Keyframes rounded onto the same frame are moved apart in
+// whole frames, and stay between the (fixed) keyframes outside the
+// range. Returns false, without changing the keys, if there are not
+// enough whole frames between those keyframes.
+inline
+bool snapCurveKeyTimes(CurveKeys &keys, int firstKey, int lastKey) {
+    int numKeys = (int) keys.numKeys();
+    const double lowest = -std::numeric_limits<double>::max();
+    const double highest = std::numeric_limits<double>::max();
+    double minTime = (firstKey > 0) ? (std::floor(keys.times[firstKey - 1]) + 1.0) : lowest;
+    double maxTime = (lastKey < (numKeys - 1)) ? (std::ceil(keys.times[lastKey + 1]) - 1.0) : highest;
+
+    std::vector<double> times(keys.times.begin() + firstKey, keys.times.begin() + lastKey + 1);
+    int num = (int) times.size();
+    for (int i = 0; i < num; ++i) {
+        double lower = (i > 0) ? (times[i - 1] + 1.0) : minTime;
+        times[i] = std::max(roundToFrame(times[i]), lower);
+    }
+    for (int i = num - 1; i >= 0; --i) {
+        double upper = (i < (num - 1)) ? (times[i + 1] - 1.0) : maxTime;
+        times[i] = std::min(times[i], upper);
+    }
+    if ((num > 0) && (times[0] < minTime)) {
+        return false;
+    }
+    std::copy(times.begin(), times.end(), keys.times.begin() + firstKey);
+    return true;
+}
+
+
+// Index of the segment (first key of the segment) containing time 't'.
+// Returns -1 before the first key and numKeys-1 after the last key.
+inline
+int findCurveSegment(const CurveKeys &keys, double t) {
+    std::vector<double>::const_iterator it;
+    it = std::upper_bound(keys.times.begin(), keys.times.end(), t);
+    return (int) (it - keys.times.begin()) - 1;
+}
+
+
+// Evaluate a single Hermite segment between keys 'k' and 'k + 1'.
+inline
+double evaluateCurveSegment(const CurveKeys &keys, unsigned int k, double t) {
+    double t0 = keys.times[k];
+    double t1 = keys.times[k + 1];
+    double dt = t1 - t0;
+    double u = (t - t0) / dt;
+    double u2 = u * u;
+    double u3 = u2 * u;
+    double h00 = (2.0 * u3) - (3.0 * u2) + 1.0;
+    double h10 = u3 - (2.0 * u2) + u;
+    double h01 = (-2.0 * u3) + (3.0 * u2);
+    double h11 = u3 - u2;
+    double m0 = angleToSlope(keys.outAngles[k], keys.framesPerSecond);
+    double m1 = angleToSlope(keys.inAngles[k + 1], keys.framesPerSecond);
+    return (h00 * keys.values[k])
+           + (h10 * dt * m0)
+           + (h01 * keys.values[k + 1])
+           + (h11 * dt * m1);
+}
+
+
+// Maximum Newton iterations finding the Bezier parameter of a time.
+const int kMaxBezierIterations = 32;
+
+
+// Evaluate a single weighted (Bezier) segment between keys 'k' and
+// 'k + 1'. The control points are a third of the tangent away from the
+// keys, and are kept inside the segment's time range (scaling the
+// tangent) so time increases along the segment.
+inline
+double evaluateWeightedCurveSegment(const CurveKeys &keys, unsigned int k, double t) {
+    const double toRadians = M_PI / 180.0;
+    double t0 = keys.times[k];
+    double t3 = keys.times[k + 1];
+    double v0 = keys.values[k];
+    double v3 = keys.values[k + 1];
+    double dt = t3 - t0;
+    double outAngle = keys.outAngles[k] * toRadians;
+    double inAngle = keys.inAngles[k + 1] * toRadians;
+    double x1 = keys.outWeights[k] * std::cos(outAngle) * keys.framesPerSecond / 3.0;
+    double y1 = keys.outWeights[k] * std::sin(outAngle) / 3.0;
+    double x2 = keys.inWeights[k + 1] * std::cos(inAngle) * keys.framesPerSecond / 3.0;
+    double y2 = keys.inWeights[k + 1] * std::sin(inAngle) / 3.0;
+    if (x1 > dt) {
+        y1 *= dt / x1;
+        x1 = dt;
+    }
+    if (x2 > dt) {
+        y2 *= dt / x2;
+        x2 = dt;
+    }
+    x1 = t0 + x1;
+    y1 = v0 + y1;
+    x2 = t3 - x2;
+    y2 = v3 - y2;
+
+    // Find the Bezier parameter 's' at time 't', by Newton iterations
+    // kept inside a bisection bracket.
+    double s = (t - t0) / dt;
+    double low = 0.0;
+    double high = 1.0;
+    for (int i = 0; i < kMaxBezierIterations; ++i) {
+        double r = 1.0 - s;
+        double x = (r * r * r * t0) + (3.0 * r * r * s * x1) + (3.0 * r * s * s * x2) + (s * s * s * t3);
+        double error = x - t;
+        if (fabs(error) <= (1.0e-10 * dt)) {
+            break;
+        }
+        if (error > 0.0) {
+            high = s;
+        } else {
+            low = s;
+        }
+        double dx = 3.0 * ((r * r * (x1 - t0)) + (2.0 * r * s * (x2 - x1)) + (s * s * (t3 - x2)));
+        double next = (dx > 0.0) ? (s - (error / dx)) : low - 1.0;
+        s = ((next > low) && (next < high)) ? next : (0.5 * (low + high));
+    }
+    double r = 1.0 - s;
+    return (r * r * r * v0) + (3.0 * r * r * s * y1) + (3.0 * r * s * s * y2) + (s * s * s * v3);
+}
+
+
+// Make the curve weighted, with weights that keep its shape; each
+// tangent reaches a third of the way along its segment in time.
+inline
+void makeCurveKeysWeighted(CurveKeys &keys) {
+    unsigned int num = keys.numKeys();
+    const double toRadians = M_PI / 180.0;
+    if (keys.weighted || (num < 2)) {
+        keys.weighted = true;
+        return;
+    }
+    for (unsigned int k = 0; k < num; ++k) {
+        double inTime = (k > 0) ? (keys.times[k] - keys.times[k - 1]) : (keys.times[1] - keys.times[0]);
+        double outTime = (k < (num - 1)) ? (keys.times[k + 1] - keys.times[k]) : inTime;
+        double inCos = std::max(std::cos(keys.inAngles[k] * toRadians), 1.0e-6);
+        double outCos = std::max(std::cos(keys.outAngles[k] * toRadians), 1.0e-6);
+        keys.inWeights[k] = inTime / (keys.framesPerSecond * inCos);
+        keys.outWeights[k] = outTime / (keys.framesPerSecond * outCos);
+    }
+    keys.weighted = true;
+}
+
+
+// Evaluate the curve at time 't' (in frames).
+inline
+double evaluateCurve(const CurveKeys &keys, double t) {
+    unsigned int num = keys.numKeys();
+    if (num == 0) {
+        return 0.0;
+    }
+    double start = keys.times[0];
+    double end = keys.times[num - 1];
+    double span = end - start;
+    if ((span > 0.0)
+        && (((t < start) && isCyclicInfinity(keys.preInfinity))
+            || ((t > end) && isCyclicInfinity(keys.postInfinity)))) {
+        // Repeat the curve, every other cycle reversed when oscillating
+        // and offset by the value change per cycle when relative.
+        int infinity = (t < start) ? keys.preInfinity : keys.postInfinity;
+        double cycle = std::floor((t - start) / span);
+        double local = std::min(std::max(t - (cycle * span), start), end);
+        if ((infinity == kInfinityOscillate) && (std::fmod(cycle, 2.0) != 0.0)) {
+            local = start + end - local;
+        }
+        double v = evaluateCurve(keys, local);
+        if (infinity == kInfinityCycleRelative) {
+            v += cycle * (keys.values[num - 1] - keys.values[0]);
+        }
+        return v;
+    }
+    int k = findCurveSegment(keys, t);
+    if (k < 0) {
+        double v = keys.values[0];
+        if (keys.preInfinity == kInfinityLinear) {
+            v += (t - keys.times[0]) * angleToSlope(keys.inAngles[0], keys.framesPerSecond);
+        }
+        return v;
+    }
+    if (k >= (int) (num - 1)) {
+        double v = keys.values[num - 1];
+        if (keys.postInfinity == kInfinityLinear) {
+            v += (t - keys.times[num - 1]) * angleToSlope(keys.outAngles[num - 1], keys.framesPerSecond);
+        }
+        return v;
+    }
+    if (keys.weighted) {
+        return evaluateWeightedCurveSegment(keys, (unsigned int) k, t);
+    }
+    return evaluateCurveSegment(keys, (unsigned int) k, t);
+}
+
+
+// Evaluate samples at time 't', linearly interpolated between samples
+// and constant outside them.
+inline
+double evaluateCurveSamples(const CurveSamples &samples, double t) {
+    unsigned int num = samples.numSamples();
+    if (num == 0) {
+        return 0.0;
+    }
+    std::vector<double>::const_iterator it;
+    it = std::upper_bound(samples.times.begin(), samples.times.end(), t);
+    unsigned int i = (unsigned int) (it - samples.times.begin());
+    if (i == 0) {
+        return samples.values[0];
+    }
+    if (i >= num) {
+        return samples.values[num - 1];
+    }
+    double t0 = samples.times[i - 1];
+    double u = (t - t0) / (samples.times[i] - t0);
+    return samples.values[i - 1] + (u * (samples.values[i] - samples.values[i - 1]));
+}
+
+
+// Stretch out the destination keyframes to align to the source
+// start/end times.
+inline
+void scaleCurveKeyTimes(double start,
+                        double end,
+                        CurveKeys &dstKeys,
+                        bool forceWholeFrames) {
+    unsigned int dstNumKeys = dstKeys.numKeys();
+    double prevStart = dstKeys.times[0];
+    double prevEnd = dstKeys.times[dstNumKeys - 1];
+    dstKeys.preInfinity = kInfinityLinear;
+    dstKeys.postInfinity = kInfinityLinear;
+
+    std::vector<double> times(dstNumKeys);
+    times[0] = start;
+    for (unsigned int k = 1; k < (dstNumKeys - 1); ++k) {
+        double prevMid = dstKeys.times[k];
+
+        // TODO: The 'mid' values are still a little wrong.
+        double newDist = end - start;
+        double prevDist = prevEnd - prevStart;
+        double prevMidRatio = (prevMid - prevStart) / prevEnd;
+        double mid = ((start * prevMidRatio) +
+                      ((prevEnd * ((newDist + 1.0) / prevDist)) * prevMidRatio));
+        if (forceWholeFrames) {
+            mid = roundToFrame(mid);
+        }
+        times[k] = mid;
+    }
+    times[dstNumKeys - 1] = end;
+
+    dstKeys.times = times;
+    if (!forceWholeFrames || !snapCurveKeyTimes(dstKeys, 0, (int) dstNumKeys - 1)) {
+        sortCurveKeyTimes(dstKeys);
+    }
+}
+
+
+// Stretch out the destination keyframes to align to the source
+// curve's start/end keyframes.
+inline
+void scaleCurveKeyTimes(const CurveKeys &srcKeys,
+                        CurveKeys &dstKeys,
+                        bool forceWholeFrames) {
+    scaleCurveKeyTimes(srcKeys.times[0],
+                       srcKeys.times[srcKeys.numKeys() - 1],
+                       dstKeys,
+                       forceWholeFrames);
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_CURVE_H
@@ -0,0 +1,84 @@
+/*
+ * Background solve jobs.
+ *
+ * A job holds snapshots of the curves, is solved on a worker thread,
+ * and is applied on the main thread (from an idle callback) by running
+ * 'animCurveMatch -applyJob <id>', so the change is undoable.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_JOBS_H
+#define MAYA_ANIM_CURVE_MATCH_JOBS_H
+
+// STL
+#include <atomic>    // atomic
+#include <memory>    // shared_ptr
+#include <string>    // string
+#include <thread>    // thread
+
+// Utils
+#include <animCurveMatchManifest.h>
+
+
+enum SolveJobState {
+    kJobRunning = 0,
+    kJobDone,
+    kJobApplied,
+    kJobFailed,
+    kJobCancelled
+};
+
+
+// A 'CurveJob' solved in the background.
+struct SolveJob : public CurveJob {
+    SolveJob() :
+            id(0),
+            applyQueued(false),
+            state(kJobRunning),
+            cancel(false),
+            finished(false) {}
+
+    int id;
+
+    // Chrome trace file written when the job finishes, may be empty.
+    std::string traceFile;
+
+    bool applyQueued;
+    std::atomic<int> state;
+    std::atomic<bool> cancel;
+
+    // Set once the worker thread no longer uses the job, so it can be
+    // joined without waiting.
+    std::atomic<bool> finished;
+    std::thread thread;
+};
+
+
+// Start solving 'job' on a worker thread. Returns the new job id.
+int startSolveJob(std::shared_ptr<SolveJob> job);
+
+// Find a job by id, returns an empty pointer if there is no such job
+// (or it was removed).
+std::shared_ptr<SolveJob> findSolveJob(int id);
+
+// State of a job by id, also of removed jobs. Returns -1 if there is no
+// such job.
+int findSolveJobState(int id);
+
+// Remove a job that is applied, failed or cancelled, freeing its
+// snapshots; only its final state is kept. Waits for the worker thread.
+void removeSolveJob(int id);
+
+// Is any job (or, with 'traced', any job writing a trace) still
+// running on its worker thread?
+bool isSolveJobRunning(bool traced);
+
+// Name of a job state, as returned by the '-jobStatus' flag.
+const char *solveJobStateName(int state);
+
+// Cancel all jobs and wait for the worker threads to finish; used
+// when the plug-in is unloaded.
+void stopAllSolveJobs();
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_JOBS_H
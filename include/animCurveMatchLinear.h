@@ -0,0 +1,212 @@
+/*
+ * Linear least squares of a curve's key values and tangent slopes.
+ *
+ * With fixed keyframe times, a Hermite curve is linear in the key
+ * values and tangent slopes. Each sample only depends on the two keys
+ * of its segment, so the normal equations are a banded matrix, which
+ * is factorised (LDL^T) and solved directly.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_LINEAR_H
+#define MAYA_ANIM_CURVE_MATCH_LINEAR_H
+
+// STL
+#include <cmath>     // fabs
+#include <vector>    // vector
+#include <algorithm> // min, max
+#include <utility>   // swap
+
+// Utils
+#include <animCurveMatchCurve.h>
+
+
+// Linear unknowns of each keyframe; value, in-tangent slope and
+// out-tangent slope (value per frame).
+const int kLinearUnknownsPerKey = 3;
+
+// Largest distance between two unknowns used by the same sample; from
+// the value of key 'k' to the in-tangent slope of key 'k + 1'.
+const int kCurveBandwidth = 4;
+
+// Pivots smaller than this (relative to the largest diagonal) make
+// the matrix singular.
+const double kMinPivot = 1.0e-14;
+
+
+// Symmetric band matrix, only the diagonal and the 'bandwidth'
+// diagonals above it are stored.
+struct BandedMatrix {
+    int size;
+    int bandwidth;
+    std::vector<double> data;
+
+    BandedMatrix() : size(0), bandwidth(0) {}
+
+    void resize(int num, int band) {
+        size = num;
+        bandwidth = band;
+        data.assign(size * (bandwidth + 1), 0.0);
+    }
+
+    // Element (i, j), with i <= j <= i + bandwidth.
+    double &at(int i, int j) {
+        return data[(i * (bandwidth + 1)) + (j - i)];
+    }
+
+    double at(int i, int j) const {
+        return data[(i * (bandwidth + 1)) + (j - i)];
+    }
+
+    // Add to element (i, j) of the symmetric matrix, in either order.
+    void add(int i, int j, double value) {
+        if (j < i) {
+            std::swap(i, j);
+        }
+        at(i, j) += value;
+    }
+};
+
+
+// Factorise 'matrix' in place into L D L^T; D is stored on the
+// diagonal and L (transposed) above it. Returns false if the matrix is
+// singular (or not positive definite).
+inline
+bool factorBandedLDLT(BandedMatrix &matrix) {
+    int size = matrix.size;
+    int band = matrix.bandwidth;
+    double maxDiagonal = 0.0;
+    for (int i = 0; i < size; ++i) {
+        maxDiagonal = std::max(maxDiagonal, fabs(matrix.at(i, i)));
+    }
+    double minPivot = kMinPivot * std::max(maxDiagonal, 1.0e-300);
+
+    for (int j = 0; j < size; ++j) {
+        int first = std::max(0, j - band);
+        double d = matrix.at(j, j);
+        for (int k = first; k < j; ++k) {
+            double l = matrix.at(k, j);
+            d -= l * l * matrix.at(k, k);
+        }
+        if (d <= minPivot) {
+            return false;
+        }
+        matrix.at(j, j) = d;
+
+        int last = std::min(size - 1, j + band);
+        for (int i = j + 1; i <= last; ++i) {
+            double sum = matrix.at(j, i);
+            for (int k = std::max(0, i - band); k < j; ++k) {
+                sum -= matrix.at(k, i) * matrix.at(k, j) * matrix.at(k, k);
+            }
+            matrix.at(j, i) = sum / d;
+        }
+    }
+    return true;
+}
+
+
+// Solve 'matrix' x = 'rhs' in place, with a matrix factorised by
+// 'factorBandedLDLT'.
+inline
+void solveBandedLDLT(const BandedMatrix &matrix, std::vector<double> &rhs) {
+    int size = matrix.size;
+    int band = matrix.bandwidth;
+    for (int i = 0; i < size; ++i) {
+        for (int k = std::max(0, i - band); k < i; ++k) {
+            rhs[i] -= matrix.at(k, i) * rhs[k];
+        }
+    }
+    for (int i = 0; i < size; ++i) {
+        rhs[i] /= matrix.at(i, i);
+    }
+    for (int i = size - 1; i >= 0; --i) {
+        int last = std::min(size - 1, i + band);
+        for (int k = i + 1; k <= last; ++k) {
+            rhs[i] -= matrix.at(i, k) * rhs[k];
+        }
+    }
+}
+
+
+// The curve value at time 't' as a linear combination of the key
+// unknowns; writes the unknown indices and coefficients, and returns
+// the number of terms (at most 4). Matches 'evaluateCurve'.
+inline
+int curveSampleBasis(const CurveKeys &keys, double t, int *indices, double *coeffs) {
+    const int num = (int) keys.numKeys();
+    int k = findCurveSegment(keys, t);
+    if (k < 0) {
+        indices[0] = 0;
+        coeffs[0] = 1.0;
+        if (keys.preInfinity != kInfinityLinear) {
+            return 1;
+        }
+        indices[1] = 1;
+        coeffs[1] = t - keys.times[0];
+        return 2;
+    }
+    if (k >= (num - 1)) {
+        indices[0] = (num - 1) * kLinearUnknownsPerKey;
+        coeffs[0] = 1.0;
+        if (keys.postInfinity != kInfinityLinear) {
+            return 1;
+        }
+        indices[1] = ((num - 1) * kLinearUnknownsPerKey) + 2;
+        coeffs[1] = t - keys.times[num - 1];
+        return 2;
+    }
+
+    double t0 = keys.times[k];
+    double dt = keys.times[k + 1] - t0;
+    double u = (t - t0) / dt;
+    double u2 = u * u;
+    double u3 = u2 * u;
+    indices[0] = k * kLinearUnknownsPerKey;
+    coeffs[0] = (2.0 * u3) - (3.0 * u2) + 1.0;
+    indices[1] = (k * kLinearUnknownsPerKey) + 2;
+    coeffs[1] = (u3 - (2.0 * u2) + u) * dt;
+    indices[2] = (k + 1) * kLinearUnknownsPerKey;
+    coeffs[2] = (-2.0 * u3) + (3.0 * u2);
+    indices[3] = ((k + 1) * kLinearUnknownsPerKey) + 1;
+    coeffs[3] = (u3 - u2) * dt;
+    return 4;
+}
+
+
+// Copy the linear unknowns of the keys into 'unknowns'.
+inline
+void getCurveUnknowns(const CurveKeys &keys, std::vector<double> &unknowns) {
+    unsigned int num = keys.numKeys();
+    unknowns.resize(num * kLinearUnknownsPerKey);
+    for (unsigned int k = 0; k < num; ++k) {
+        unknowns[(k * kLinearUnknownsPerKey) + 0] = keys.values[k];
+        unknowns[(k * kLinearUnknownsPerKey) + 1] = angleToSlope(keys.inAngles[k], keys.framesPerSecond);
+        unknowns[(k * kLinearUnknownsPerKey) + 2] = angleToSlope(keys.outAngles[k], keys.framesPerSecond);
+    }
+}
+
+
+// Set the keys from the linear unknowns marked as 'solved', the other
+// key attributes are not touched.
+inline
+void setCurveUnknowns(const std::vector<double> &unknowns,
+                      const std::vector<bool> &solved,
+                      CurveKeys &keys) {
+    unsigned int num = keys.numKeys();
+    for (unsigned int k = 0; k < num; ++k) {
+        unsigned int i = k * kLinearUnknownsPerKey;
+        if (solved[i + 0]) {
+            keys.values[k] = unknowns[i + 0];
+        }
+        if (solved[i + 1]) {
+            keys.inAngles[k] = slopeToAngle(unknowns[i + 1], keys.framesPerSecond);
+        }
+        if (solved[i + 2]) {
+            keys.outAngles[k] = slopeToAngle(unknowns[i + 2], keys.framesPerSecond);
+        }
+    }
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_LINEAR_H
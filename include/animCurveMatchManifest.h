@@ -0,0 +1,483 @@
+/*
+ * Job manifests and result files, for solving many curve pairs
+ * outside of Maya.
+ *
+ * A manifest lists curve pairs (as 'CurveKeys' or 'CurveSamples'
+ * snapshots) with their solve settings. It is written by
+ * 'animCurveMatch -exportJob', solved by the 'animCurveMatchBatch'
+ * executable, and the results are applied back with
+ * 'animCurveMatch -importResults'.
+ *
+ * Both files are plain text, a header line followed by records of
+ * whitespace separated tokens. Numbers are written with enough digits
+ * to be read back exactly. Each record ends with an "end" token, so a
+ * record cut short (even inside a number) is detected.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_MANIFEST_H
+#define MAYA_ANIM_CURVE_MATCH_MANIFEST_H
+
+// STL
+#include <cmath>     // isfinite
+#include <cstdlib>   // strtod
+#include <string>    // string
+#include <vector>    // vector
+#include <fstream>   // ifstream, ofstream
+#include <iostream>  // istream, ostream
+#include <iomanip>   // setprecision
+
+// Utils
+#include <utilities/debugUtils.h>
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+#include <animCurveMatchReduce.h>
+#include <animCurveMatchSweep.h>
+
+
+// File headers, followed by the version number.
+const char kManifestMagic[] = "animCurveMatchManifest";
+const char kResultsMagic[] = "animCurveMatchResults";
+const int kManifestVersion = 1;
+
+// Digits needed to read back a double exactly.
+const int kManifestPrecision = 17;
+
+// Most keyframes or samples in a record; a larger count is from a
+// corrupt file.
+const unsigned int kMaxManifestCount = 10000000;
+
+
+// The Maya independent part of a solve; snapshots of the curves and
+// the settings used to solve them.
+struct CurveJob {
+    CurveJob() :
+            reduce(false),
+            tolerance(0.0),
+            sweep(false),
+            minKeys(2),
+            maxKeys(2),
+            framesPerSecond(24.0),
+            error(-1.0) {}
+
+    // Curve the result is applied to.
+    std::string dstCurveName;
+
+    // Snapshots, 'dstKeys' holds the result once solved. The source is
+    // 'srcSamples' when it was baked from an attribute.
+    CurveKeys srcKeys;
+    CurveSamples srcSamples;
+    CurveKeys dstKeys;
+
+    SolverOptions options;
+    bool reduce;
+    double tolerance;
+
+    // Key count sweep, see 'sweepCurveKeys'.
+    bool sweep;
+    unsigned int minKeys;
+    unsigned int maxKeys;
+    double framesPerSecond;
+
+    double error;
+
+    // All destination keyframes are replaced, the keyframe count may
+    // differ from the destination curve.
+    bool replacesKeys() const {
+        return reduce || sweep;
+    }
+};
+
+
+// Solve the job's snapshots on the calling thread, setting 'dstKeys'
+// and 'error'. Returns false if the solve failed or was cancelled.
+inline
+bool solveCurveJob(CurveJob &job) {
+    bool ret = false;
+    if (job.sweep) {
+        CurveSource source;
+        if (job.srcSamples.numSamples() > 0) {
+            source.samples = &job.srcSamples;
+        } else {
+            source.keys = &job.srcKeys;
+        }
+        ret = sweepCurveKeys(source,
+                             job.minKeys,
+                             job.maxKeys,
+                             job.options,
+                             job.tolerance,
+                             job.framesPerSecond,
+                             job.dstKeys,
+                             job.error);
+    } else if (job.srcSamples.numSamples() > 0) {
+        ret = solveCurveSamples(job.srcSamples,
+                                job.dstKeys,
+                                job.options,
+                                job.error);
+    } else if (job.reduce) {
+        ret = reduceAndSolveCurveKeys(job.srcKeys,
+                                      job.dstKeys,
+                                      job.options,
+                                      job.tolerance,
+                                      job.error);
+    } else {
+        ret = solveCurveKeys(job.srcKeys,
+                             job.dstKeys,
+                             job.options,
+                             job.error);
+    }
+    return ret;
+}
+
+
+// Read the next token and check it is 'expected'.
+inline
+bool readManifestToken(std::istream &stream, const char *expected) {
+    std::string token;
+    stream >> token;
+    return stream && (token == expected);
+}
+
+
+// Read a number token. Unlike operator>>, this also reads the "nan"
+// and "inf" written for non-finite values.
+inline
+bool readManifestDouble(std::istream &stream, double &value) {
+    std::string token;
+    if (!(stream >> token)) {
+        return false;
+    }
+    char *end = NULL;
+    value = strtod(token.c_str(), &end);
+    if (end != (token.c_str() + token.size())) {
+        stream.setstate(std::ios::failbit);
+        return false;
+    }
+    return true;
+}
+
+
+// Check the header line of a manifest or results file.
+inline
+bool readManifestHeader(std::istream &stream, const char *magic) {
+    int version = 0;
+    if (!readManifestToken(stream, magic)) {
+        return false;
+    }
+    stream >> version;
+    return stream && (version == kManifestVersion);
+}
+
+
+inline
+void writeManifestKeys(std::ostream &stream, const CurveKeys &keys) {
+    unsigned int numKeys = keys.numKeys();
+    stream << "keys " << numKeys
+           << " " << keys.framesPerSecond
+           << " " << keys.preInfinity
+           << " " << keys.postInfinity
+           << " " << keys.weighted << "\n";
+    for (unsigned int i = 0; i < numKeys; ++i) {
+        stream << keys.times[i]
+               << " " << keys.values[i]
+               << " " << keys.inAngles[i]
+               << " " << keys.outAngles[i]
+               << " " << keys.inWeights[i]
+               << " " << keys.outWeights[i] << "\n";
+    }
+}
+
+
+inline
+bool readManifestKeys(std::istream &stream, CurveKeys &keys) {
+    unsigned int numKeys = 0;
+    if (!readManifestToken(stream, "keys")) {
+        return false;
+    }
+    stream >> numKeys
+           >> keys.framesPerSecond
+           >> keys.preInfinity
+           >> keys.postInfinity
+           >> keys.weighted;
+    if (!stream || (numKeys > kMaxManifestCount)) {
+        return false;
+    }
+    keys.resize(numKeys);
+    for (unsigned int i = 0; i < numKeys; ++i) {
+        if (!readManifestDouble(stream, keys.times[i])
+            || !readManifestDouble(stream, keys.values[i])
+            || !readManifestDouble(stream, keys.inAngles[i])
+            || !readManifestDouble(stream, keys.outAngles[i])
+            || !readManifestDouble(stream, keys.inWeights[i])
+            || !readManifestDouble(stream, keys.outWeights[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+inline
+void writeManifestSamples(std::ostream &stream, const CurveSamples &samples) {
+    unsigned int numSamples = samples.numSamples();
+    stream << "samples " << numSamples << "\n";
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        stream << samples.times[i] << " " << samples.values[i] << "\n";
+    }
+}
+
+
+inline
+bool readManifestSamples(std::istream &stream, CurveSamples &samples) {
+    unsigned int numSamples = 0;
+    if (!readManifestToken(stream, "samples")) {
+        return false;
+    }
+    stream >> numSamples;
+    if (!stream || (numSamples > kMaxManifestCount)) {
+        return false;
+    }
+    samples.times.resize(numSamples);
+    samples.values.resize(numSamples);
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        if (!readManifestDouble(stream, samples.times[i])
+            || !readManifestDouble(stream, samples.values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Solve settings of a job; the 'cancel' flag is not stored.
+inline
+void writeManifestSettings(std::ostream &stream, const CurveJob &job) {
+    const SolverOptions &options = job.options;
+    stream << "options "
+           << options.iterMax
+           << " " << options.adjustValues
+           << " " << options.adjustTimes
+           << " " << options.adjustTangentAngles
+           << " " << options.adjustTangentWeights
+           << " " << options.scaleTimeKeys
+           << " " << options.forceWholeFrames
+           << " " << options.addKeys
+           << " " << options.restarts
+           << " " << options.directSolve
+           << " " << options.polishIterations
+           << " " << options.timeBudget
+           << " " << options.targetRmsError
+           << " " << options.targetMaxError
+           << " " << options.firstKey
+           << " " << options.lastKey
+           << " " << options.streamed
+           << " " << options.covariance
+           << " " << options.keyRanges.size();
+    for (size_t i = 0; i < options.keyRanges.size(); ++i) {
+        stream << " " << options.keyRanges[i];
+    }
+    stream << "\n";
+    stream << "mode "
+           << job.reduce
+           << " " << job.tolerance
+           << " " << job.sweep
+           << " " << job.minKeys
+           << " " << job.maxKeys
+           << " " << job.framesPerSecond << "\n";
+}
+
+
+inline
+bool readManifestSettings(std::istream &stream, CurveJob &job) {
+    SolverOptions &options = job.options;
+    if (!readManifestToken(stream, "options")) {
+        return false;
+    }
+    stream >> options.iterMax
+           >> options.adjustValues
+           >> options.adjustTimes
+           >> options.adjustTangentAngles
+           >> options.adjustTangentWeights
+           >> options.scaleTimeKeys
+           >> options.forceWholeFrames
+           >> options.addKeys
+           >> options.restarts
+           >> options.directSolve
+           >> options.polishIterations
+           >> options.timeBudget
+           >> options.targetRmsError
+           >> options.targetMaxError
+           >> options.firstKey
+           >> options.lastKey
+           >> options.streamed
+           >> options.covariance;
+    size_t numKeyRanges = 0;
+    stream >> numKeyRanges;
+    if (!stream || (numKeyRanges % 2) != 0) {
+        return false;
+    }
+    options.keyRanges.clear();
+    for (size_t i = 0; (i < numKeyRanges) && stream; ++i) {
+        int key = 0;
+        stream >> key;
+        options.keyRanges.push_back(key);
+    }
+    options.cancel = NULL;
+    if (!stream || !readManifestToken(stream, "mode")) {
+        return false;
+    }
+    stream >> job.reduce
+           >> job.tolerance
+           >> job.sweep
+           >> job.minKeys
+           >> job.maxKeys
+           >> job.framesPerSecond;
+    return (bool) stream;
+}
+
+
+// Append 'job' to the manifest at 'path', creating the manifest if it
+// does not exist. Returns false if the file could not be written.
+inline
+bool appendManifestJob(const std::string &path, const CurveJob &job) {
+    bool exists = false;
+    {
+        std::ifstream file(path.c_str());
+        exists = file && (file.peek() != std::ifstream::traits_type::eof());
+        if (exists && !readManifestHeader(file, kManifestMagic)) {
+            ERR("Not an animCurveMatch manifest: " << path);
+            return false;
+        }
+    }
+
+    std::ofstream file(path.c_str(), std::ios::app);
+    if (!file) {
+        return false;
+    }
+    file << std::setprecision(kManifestPrecision);
+    if (!exists) {
+        file << kManifestMagic << " " << kManifestVersion << "\n";
+    }
+    file << "job " << job.dstCurveName << "\n";
+    writeManifestSettings(file, job);
+    writeManifestKeys(file, job.srcKeys);
+    writeManifestSamples(file, job.srcSamples);
+    writeManifestKeys(file, job.dstKeys);
+    file << "end\n";
+    return (bool) file;
+}
+
+
+// Read all jobs of the manifest at 'path'. Returns false if the file
+// could not be read, or a job is malformed.
+inline
+bool readManifest(const std::string &path, std::vector<CurveJob> &jobs) {
+    std::ifstream file(path.c_str());
+    if (!file || !readManifestHeader(file, kManifestMagic)) {
+        return false;
+    }
+    jobs.clear();
+    std::string token;
+    while (file >> token) {
+        CurveJob job;
+        if ((token != "job") || !(file >> job.dstCurveName)
+            || !readManifestSettings(file, job)
+            || !readManifestKeys(file, job.srcKeys)
+            || !readManifestSamples(file, job.srcSamples)
+            || !readManifestKeys(file, job.dstKeys)
+            || !readManifestToken(file, "end")) {
+            ERR("Malformed manifest job " << jobs.size() << ": " << path);
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+
+// Solved job of a results file. 'index' is the job's position in the
+// manifest, and 'job' holds the settings and solved keyframes (not the
+// source).
+struct JobResult {
+    JobResult() :
+            index(0),
+            solved(false) {}
+
+    unsigned int index;
+    bool solved;
+    CurveJob job;
+};
+
+
+inline
+void writeJobResult(std::ostream &stream,
+                    unsigned int index,
+                    bool solved,
+                    const CurveJob &job) {
+    // A stopped solve may leave a non-finite error, written as the
+    // "no error" value instead.
+    double error = std::isfinite(job.error) ? job.error : -1.0;
+    stream << "result " << index
+           << " " << job.dstCurveName
+           << " " << solved
+           << " " << error << "\n";
+    writeManifestSettings(stream, job);
+    writeManifestKeys(stream, job.dstKeys);
+    stream << "end\n";
+}
+
+
+// Read results from 'stream' (after the header) until the end, or
+// until a malformed record (such as one cut short by a crash). Returns
+// false if a malformed record was found.
+inline
+bool readJobResults(std::istream &stream, std::vector<JobResult> &results) {
+    std::string token;
+    while (stream >> token) {
+        JobResult result;
+        CurveJob &job = result.job;
+        if ((token != "result")
+            || !(stream >> result.index >> job.dstCurveName >> result.solved)
+            || !readManifestDouble(stream, job.error)
+            || !readManifestSettings(stream, job)
+            || !readManifestKeys(stream, job.dstKeys)
+            || !readManifestToken(stream, "end")) {
+            return false;
+        }
+        results.push_back(result);
+    }
+    return true;
+}
+
+
+// Write 'results' to a results file at 'path'. Returns false if the
+// file could not be written.
+inline
+bool writeResultsFile(const std::string &path, const std::vector<JobResult> &results) {
+    std::ofstream file(path.c_str(), std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file << std::setprecision(kManifestPrecision);
+    file << kResultsMagic << " " << kManifestVersion << "\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        writeJobResult(file, results[i].index, results[i].solved, results[i].job);
+    }
+    return (bool) file;
+}
+
+
+// Read the results file at 'path'. Returns false if the file could not
+// be read or is malformed.
+inline
+bool readResultsFile(const std::string &path, std::vector<JobResult> &results) {
+    std::ifstream file(path.c_str());
+    if (!file || !readManifestHeader(file, kResultsMagic)) {
+        return false;
+    }
+    results.clear();
+    return readJobResults(file, results);
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_MANIFEST_H
@@ -0,0 +1,403 @@
+/*
+ * Keyframe reduction, finds the fewest keyframes that match a dense
+ * curve within an error tolerance.
+ *
+ * Candidate keyframe positions are the source keyframe times, and the
+ * error is measured on every whole frame (and source keyframe) of the
+ * source. Each segment between two candidates is fitted in closed form
+ * (values are taken from the source, the two tangent slopes are solved
+ * by linear least squares), and a dynamic programme picks the fewest
+ * segments whose maximum error is within the tolerance.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_REDUCE_H
+#define MAYA_ANIM_CURVE_MATCH_REDUCE_H
+
+// STL
+#include <cmath>     // fabs, ceil, floor
+#include <vector>    // vector
+#include <limits>    // numeric_limits
+#include <algorithm> // sort, unique, lower_bound
+
+// Utils
+#include <utilities/debugUtils.h>
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+
+
+// Source sampled where the reduction measures its error; every whole
+// frame and every keyframe. 'keyIndex' is the sample of each keyframe.
+struct ReduceSamples {
+    std::vector<double> times;
+    std::vector<double> values;
+    std::vector<int> keyIndex;
+};
+
+
+inline
+void sampleReduceSource(const CurveKeys &srcKeys, ReduceSamples &samples) {
+    unsigned int numKeys = srcKeys.numKeys();
+    double start = srcKeys.times[0];
+    double end = srcKeys.times[numKeys - 1];
+    samples.times.assign(srcKeys.times.begin(), srcKeys.times.end());
+    for (double t = std::ceil(start); t <= end; t += 1.0) {
+        samples.times.push_back(t);
+    }
+    std::sort(samples.times.begin(), samples.times.end());
+    samples.times.erase(std::unique(samples.times.begin(), samples.times.end()), samples.times.end());
+
+    samples.values.resize(samples.times.size());
+    for (size_t i = 0; i < samples.times.size(); ++i) {
+        samples.values[i] = evaluateCurve(srcKeys, samples.times[i]);
+    }
+    samples.keyIndex.resize(numKeys);
+    for (unsigned int k = 0; k < numKeys; ++k) {
+        samples.keyIndex[k] = (int) (std::lower_bound(samples.times.begin(), samples.times.end(), srcKeys.times[k])
+                                     - samples.times.begin());
+    }
+}
+
+
+// Running sums over the samples inside a segment, relative to the
+// segment start (time 't0' and value 'v0'), from which the segment fit
+// is solved in constant time. Samples are added in increasing time, as
+// the segment end moves later.
+struct SegmentSums {
+    SegmentSums(double t0, double v0) :
+            t0(t0),
+            v0(v0),
+            count(0),
+            valueSquares(0.0) {
+        for (int p = 0; p < 7; ++p) {
+            powers[p] = 0.0;
+        }
+        for (int p = 0; p < 4; ++p) {
+            values[p] = 0.0;
+        }
+    }
+
+    void add(double t, double v) {
+        double tau = t - t0;
+        double e = v - v0;
+        double power = 1.0;
+        for (int p = 0; p < 7; ++p) {
+            powers[p] += power;
+            if (p < 4) {
+                values[p] += e * power;
+            }
+            power *= tau;
+        }
+        valueSquares += e * e;
+        count += 1;
+    }
+
+    double t0;
+    double v0;
+    int count;
+
+    // Sums of tau^p (p = 0 to 6), (v - v0) * tau^p (p = 0 to 3) and
+    // (v - v0)^2, with tau = t - t0.
+    double powers[7];
+    double values[4];
+    double valueSquares;
+};
+
+
+// Fit of a single segment between two source keyframes.
+struct SegmentFit {
+    double outSlope;
+    double inSlope;
+    double sumSquares;
+    double maxError;
+};
+
+
+// Fit the tangent slopes of the segment from 'sums.t0' to time 't1'
+// (value 'v1'), keeping the values at both ends; the slopes default to
+// 'outSlope' and 'inSlope' when the samples do not determine them.
+// Only the sum of squared errors is set, not 'maxError'.
+//
+// The segment is written with s = (t - t0) / (t1 - t0) as
+//   v0 + (v1 - v0) h01(s) + outSlope c0(s) + inSlope c1(s)
+// with cubic Hermite basis polynomials, and the 2x2 normal equations
+// are sums of products of their coefficients and the running sums.
+inline
+void fitCurveSegment(const SegmentSums &sums,
+                     double t1,
+                     double v1,
+                     double outSlope,
+                     double inSlope,
+                     SegmentFit &fit) {
+    double dt = t1 - sums.t0;
+    double dv = v1 - sums.v0;
+
+    // Sums of s^p and (v - v0) * s^p.
+    double m[7];
+    double f[4];
+    double scale = 1.0;
+    for (int p = 0; p < 7; ++p) {
+        m[p] = sums.powers[p] * scale;
+        if (p < 4) {
+            f[p] = sums.values[p] * scale;
+        }
+        scale /= dt;
+    }
+
+    // Coefficients of s^0 to s^3.
+    const double h01[4] = {0.0, 0.0, 3.0, -2.0};
+    const double c0[4] = {0.0, dt, -2.0 * dt, dt};
+    const double c1[4] = {0.0, 0.0, -dt, dt};
+
+    double a00 = 0.0, a01 = 0.0, a11 = 0.0;
+    double hc0 = 0.0, hc1 = 0.0, hh = 0.0;
+    double ec0 = 0.0, ec1 = 0.0, eh = 0.0;
+    for (int p = 0; p < 4; ++p) {
+        for (int q = 0; q < 4; ++q) {
+            a00 += c0[p] * c0[q] * m[p + q];
+            a01 += c0[p] * c1[q] * m[p + q];
+            a11 += c1[p] * c1[q] * m[p + q];
+            hc0 += h01[p] * c0[q] * m[p + q];
+            hc1 += h01[p] * c1[q] * m[p + q];
+            hh += h01[p] * h01[q] * m[p + q];
+        }
+        ec0 += c0[p] * f[p];
+        ec1 += c1[p] * f[p];
+        eh += h01[p] * f[p];
+    }
+    double b0 = ec0 - (dv * hc0);
+    double b1 = ec1 - (dv * hc1);
+    double yy = sums.valueSquares - (2.0 * dv * eh) + (dv * dv * hh);
+
+    fit.outSlope = outSlope;
+    fit.inSlope = inSlope;
+    double det = (a00 * a11) - (a01 * a01);
+    if (fabs(det) > (1.0e-12 * ((a00 * a11) + 1.0e-300))) {
+        fit.outSlope = ((a11 * b0) - (a01 * b1)) / det;
+        fit.inSlope = ((a00 * b1) - (a01 * b0)) / det;
+    }
+    double x0 = fit.outSlope;
+    double x1 = fit.inSlope;
+    fit.sumSquares = yy - (2.0 * ((x0 * b0) + (x1 * b1)))
+                     + (x0 * x0 * a00) + (2.0 * x0 * x1 * a01) + (x1 * x1 * a11);
+    fit.sumSquares = std::max(fit.sumSquares, 0.0);
+    fit.maxError = -1.0;
+}
+
+
+// Largest error of a segment fit, at the samples between samples
+// 'first' and 'last' (exclusive).
+inline
+double segmentMaxError(const ReduceSamples &samples,
+                       int first,
+                       int last,
+                       const SegmentFit &fit) {
+    double t0 = samples.times[first];
+    double t1 = samples.times[last];
+    double v0 = samples.values[first];
+    double v1 = samples.values[last];
+    double dt = t1 - t0;
+    double maxError = 0.0;
+    for (int k = first + 1; k < last; ++k) {
+        double u = (samples.times[k] - t0) / dt;
+        double u2 = u * u;
+        double u3 = u2 * u;
+        double v = ((((2.0 * u3) - (3.0 * u2) + 1.0) * v0)
+                    + ((u3 - (2.0 * u2) + u) * dt * fit.outSlope)
+                    + (((-2.0 * u3) + (3.0 * u2)) * v1)
+                    + ((u3 - u2) * dt * fit.inSlope));
+        maxError = std::max(maxError, fabs(samples.values[k] - v));
+    }
+    return maxError;
+}
+
+
+// Find the fewest source keyframes needed to match the source curve
+// within 'tolerance', the result is written into 'outKeys'. Stops
+// early (with an incomplete result) when 'cancel' is set.
+//
+// Every pair of keyframes is a candidate segment, fitted in constant
+// time from running sums. The maximum error (linear in the segment
+// length) is only measured for segments that would shorten a path,
+// and whose RMS error is within the tolerance.
+inline
+void reduceCurveKeys(const CurveKeys &srcKeys,
+                     double tolerance,
+                     const std::atomic<bool> *cancel,
+                     CurveKeys &outKeys) {
+    TRACE_SCOPE("reduce");
+    unsigned int num = srcKeys.numKeys();
+    const int unreachable = std::numeric_limits<int>::max();
+    const double fps = srcKeys.framesPerSecond;
+    ReduceSamples samples;
+    sampleReduceSource(srcKeys, samples);
+    const std::vector<int> &keyIndex = samples.keyIndex;
+
+    // Minimum number of segments to reach each candidate, and the
+    // previous candidate on that path.
+    std::vector<int> count(num, unreachable);
+    std::vector<int> previous(num, -1);
+    std::vector<SegmentFit> fits(num);
+    count[0] = 0;
+
+    SegmentFit fit;
+    for (unsigned int i = 0; i < (num - 1); ++i) {
+        if (count[i] == unreachable) {
+            continue;
+        }
+        if (isCancelled(cancel)) {
+            break;
+        }
+        SegmentSums sums(srcKeys.times[i], srcKeys.values[i]);
+        int next = keyIndex[i] + 1;
+        for (unsigned int j = i + 1; j < num; ++j) {
+            for (; next < keyIndex[j]; ++next) {
+                sums.add(samples.times[next], samples.values[next]);
+            }
+            if ((count[i] + 1) >= count[j]) {
+                continue;
+            }
+            fitCurveSegment(sums,
+                            srcKeys.times[j],
+                            srcKeys.values[j],
+                            angleToSlope(srcKeys.outAngles[i], fps),
+                            angleToSlope(srcKeys.inAngles[j], fps),
+                            fit);
+
+            // Adjacent keys always fit, so every candidate is reachable.
+            // Otherwise the RMS error is a lower bound of the maximum.
+            bool adjacent = j == (i + 1);
+            double limit = tolerance * tolerance * double(sums.count);
+            if (!adjacent && (fit.sumSquares > (limit * (1.0 + 1.0e-9)))) {
+                continue;
+            }
+            fit.maxError = segmentMaxError(samples, keyIndex[i], keyIndex[j], fit);
+            if (!adjacent && (fit.maxError > tolerance)) {
+                continue;
+            }
+            count[j] = count[i] + 1;
+            previous[j] = (int) i;
+            fits[j] = fit;
+        }
+    }
+
+    // Walk back from the last candidate.
+    std::vector<unsigned int> path;
+    for (int k = (int) num - 1; k >= 0; k = previous[k]) {
+        path.push_back((unsigned int) k);
+    }
+
+    unsigned int numKeys = (unsigned int) path.size();
+    outKeys.resize(numKeys);
+    outKeys.framesPerSecond = srcKeys.framesPerSecond;
+    outKeys.preInfinity = srcKeys.preInfinity;
+    outKeys.postInfinity = srcKeys.postInfinity;
+    outKeys.weighted = false;
+    for (unsigned int i = 0; i < numKeys; ++i) {
+        unsigned int k = path[numKeys - 1 - i];
+        outKeys.times[i] = srcKeys.times[k];
+        outKeys.values[i] = srcKeys.values[k];
+        outKeys.inAngles[i] = srcKeys.inAngles[k];
+        outKeys.outAngles[i] = srcKeys.outAngles[k];
+        if (i > 0) {
+            const SegmentFit &segment = fits[k];
+            outKeys.inAngles[i] = slopeToAngle(segment.inSlope, fps);
+            outKeys.outAngles[i - 1] = slopeToAngle(segment.outSlope, fps);
+        }
+    }
+    LOG_INFO("Reduced " << num << " keyframes to " << numKeys << " keyframes.");
+}
+
+
+// Largest absolute difference between the curves, at the samples the
+// reduction measures its error.
+inline
+double curveMaxError(const ReduceSamples &samples, const CurveKeys &dstKeys) {
+    double maxError = 0.0;
+    for (size_t i = 0; i < samples.times.size(); ++i) {
+        double error = fabs(samples.values[i] - evaluateCurve(dstKeys, samples.times[i]));
+        if (error > maxError) {
+            maxError = error;
+        }
+    }
+    return maxError;
+}
+
+
+// Errors of the reduced curve at the samples the reduction measures
+// its error.
+inline
+void makeReduceErrorReport(const ReduceSamples &samples,
+                           const CurveKeys &dstKeys,
+                           double error,
+                           ErrorReport &report) {
+    std::vector<double> residual(samples.times.size());
+    for (size_t i = 0; i < samples.times.size(); ++i) {
+        residual[i] = sampleResidual(samples.values[i], evaluateCurve(dstKeys, samples.times[i]));
+    }
+    makeErrorReport(samples.times, residual, dstKeys, error, report);
+}
+
+
+// Reduce the source curve, then polish the reduced keyframes with the
+// levmar solver. The polish is kept only if it does not push the
+// maximum error over the tolerance.
+inline
+bool reduceAndSolveCurveKeys(const CurveKeys &srcKeys,
+                             CurveKeys &dstKeys,
+                             const SolverOptions &options,
+                             double tolerance,
+                             double &outError,
+                             ErrorReport *outReport = NULL) {
+    if (srcKeys.numKeys() < 2) {
+        ERR("Source animCurve must have at least 2 keyframes.");
+        return false;
+    }
+    reduceCurveKeys(srcKeys, tolerance, options.cancel, dstKeys);
+    if (isCancelled(options.cancel)) {
+        return false;
+    }
+    ReduceSamples samples;
+    sampleReduceSource(srcKeys, samples);
+    double reducedError = curveMaxError(samples, dstKeys);
+    outError = reducedError;
+    if (dstKeys.numKeys() < 2) {
+        if (outReport != NULL) {
+            makeReduceErrorReport(samples, dstKeys, outError, *outReport);
+        }
+        return true;
+    }
+
+    SolverOptions polishOptions = options;
+    polishOptions.adjustTimes = false;
+    polishOptions.scaleTimeKeys = false;
+    polishOptions.firstKey = 0;
+    polishOptions.lastKey = -1;
+    polishOptions.keyRanges.clear();
+    CurveKeys polishKeys = dstKeys;
+    double polishError = -1.0;
+    ErrorReport polishReport;
+    ErrorReport *outPolishReport = (outReport != NULL) ? &polishReport : NULL;
+    bool ret = solveCurveKeys(srcKeys, polishKeys, polishOptions, polishError, outPolishReport);
+    bool polished = false;
+    if (ret == true) {
+        double polishMaxError = curveMaxError(samples, polishKeys);
+        if ((polishMaxError <= tolerance) || (polishMaxError < reducedError)) {
+            dstKeys = polishKeys;
+            outError = polishMaxError;
+            polished = true;
+        }
+    }
+    LOG_INFO("Reduced curve maximum error: " << outError);
+    if (outReport != NULL) {
+        makeReduceErrorReport(samples, dstKeys, outError, *outReport);
+        // The covariance is estimated by the polish solve only.
+        if (polished) {
+            outReport->keyCovariance.swap(polishReport.keyCovariance);
+        }
+    }
+    return true;
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_REDUCE_H
@@ -0,0 +1,2028 @@
+/*
+ * Uses Non-Linear Least Squares algorithm from levmar library to calculate animCurve attributes.
+ *
+ * The solver works on 'CurveKeys' snapshots only, it does not use the
+ * Maya API and may be run from any thread.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_SOLVER_H
+#define MAYA_ANIM_CURVE_MATCH_SOLVER_H
+
+// Lev-Mar
+#include <levmar.h>  //
+
+// STL
+#include <cmath>     // exp
+#include <cstdlib>   // malloc, free
+#include <string>    // string
+#include <vector>    // vector
+#include <thread>    // thread, hardware_concurrency
+#include <atomic>    // atomic
+#include <random>    // mt19937
+#include <cassert>   // assert
+#include <limits>    // numeric_limits
+#include <algorithm> // min, max, copy, lower_bound, upper_bound
+
+// Utils
+#include <utilities/debugUtils.h>
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchLinear.h>
+
+
+// Lev-Mar Termination Reasons, and the direct solve:
+const std::string reasons[9] = {
+        // reason 0
+        "no reason, should not get here",
+
+        // reason 1
+        "stopped by small gradient J^T e",
+
+        // reason 2
+        "stopped by small Dp",
+
+        // reason 3
+        "stopped by itmax",
+
+        // reason 4
+        "singular matrix. Restart from current p with increased \\mu",
+
+        // reason 5
+        "no further error reduction is possible. Restart with increased mu",
+
+        // reason 6
+        "stopped by small ||e||_2",
+
+        // reason 7
+        "stopped by invalid (i.e. NaN or Inf) \"func\" refPoints (user error)",
+
+        // reason 8 (not levmar)
+        "solved directly by linear least squares",
+};
+
+// Termination reason of the direct linear least squares solve.
+const int kDirectSolveReason = 8;
+
+// For each keyframe, a time, value, in / out tangent angles and weights may be calculated.
+const int kParamsPerKey = 6;
+
+// Initial mu, relative to the largest diagonal of J^T J. Parameters
+// are solved scaled (see 'setCurveParameterScales'), so levmar's
+// default suits curves in any units.
+const double kInitialMu = LM_INIT_MU;
+
+// Bounds of solved tangent weights, keeping them positive and finite.
+const double kMinTangentWeight = 1.0e-3;
+const double kMaxTangentWeight = 1.0e+3;
+
+// Finite difference step of the Jacobian, in scaled parameters; each
+// parameter class steps by this fraction of its scale.
+const double kDiffDelta = 1.0e-3;
+
+// Samples accumulated at a time by the streamed solver.
+const int kStreamBlockSize = 256;
+
+// Parameters of the (at most 2) keyframes a sample depends on, and
+// the bandwidth of their normal equations.
+const int kStreamParams = 2 * kParamsPerKey;
+const int kStreamBandwidth = kStreamParams - 1;
+
+// The streamed solver gives up once the damping has been increased
+// this much without reducing the error.
+const double kMaxStreamDamping = 1.0E+30;
+
+// Maximum number of alternations between the whole-frame time search
+// and the levmar solve of values and tangents.
+const int kMaxWholeFrameRounds = 8;
+
+// Maximum number of passes over all keys in one whole-frame time search.
+const int kMaxWholeFrameSweeps = 32;
+
+
+struct SolverOptions {
+    SolverOptions() :
+            iterMax(1000),
+            adjustValues(true),
+            adjustTimes(false),
+            adjustTangentAngles(true),
+            adjustTangentWeights(false),
+            scaleTimeKeys(true),
+            forceWholeFrames(true),
+            addKeys(false),
+            restarts(4),
+            directSolve(true),
+            polishIterations(0),
+            timeBudget(0.0),
+            targetRmsError(0.0),
+            targetMaxError(0.0),
+            cancel(NULL),
+            firstKey(0),
+            lastKey(-1),
+            streamed(false),
+            covariance(false),
+            maxThreads(0),
+            deadline(0) {}
+
+    int iterMax;
+    bool adjustValues;
+    bool adjustTimes;
+    bool adjustTangentAngles;
+    bool adjustTangentWeights;
+    bool scaleTimeKeys;
+    bool forceWholeFrames;
+    bool addKeys;
+
+    // Number of extra starts, run in parallel, when levmar stalls.
+    int restarts;
+
+    // Solve values and tangents by linear least squares when the key
+    // times are fixed, then polish with this many levmar iterations.
+    bool directSolve;
+    int polishIterations;
+
+    // Stop once this many seconds have passed, or once the RMS or
+    // maximum sample error is within the target, keeping the best
+    // parameters found so far. Zero disables each limit.
+    double timeBudget;
+    double targetRmsError;
+    double targetMaxError;
+
+    // When set (from another thread) the solve stops as soon as possible.
+    const std::atomic<bool> *cancel;
+
+    // Range of destination keyframes solved, the other keyframes are
+    // kept fixed. A negative 'lastKey' means the last keyframe.
+    int firstKey;
+    int lastKey;
+
+    // Separate ranges of keyframes, as (first, last) pairs in
+    // increasing order, each solved on its own instead of 'firstKey' to
+    // 'lastKey'; the keyframes between the ranges are kept fixed. See
+    // 'makeKeyRanges'.
+    std::vector<int> keyRanges;
+
+    // Accumulate the normal equations over blocks of samples, instead
+    // of building the full Jacobian; for very long sources.
+    bool streamed;
+
+    // Estimate the covariance of each keyframe's parameters into the
+    // error report (when one is given).
+    bool covariance;
+
+    // Most threads used for parallel restarts and sweep candidates,
+    // zero means one per core. Not stored in job manifests.
+    int maxThreads;
+
+    // When the 'timeBudget' runs out, set when the solve starts so that
+    // every pass of the solve shares one budget. Not stored in job
+    // manifests.
+    debug::Timestamp deadline;
+};
+
+
+struct CurveData {
+    // Source curve, sampled once before solving.
+    const std::vector<double> *sampleTimes;
+    const std::vector<double> *srcValues;
+
+    // Destination curve, modified by 'curveFunc'. Only keyframes
+    // 'firstKey' to 'lastKey' are parameters.
+    CurveKeys *dstKeys;
+    int firstKey;
+    int lastKey;
+
+    // Solved keyframe times are kept inside this range.
+    double minKeyTime;
+    double maxKeyTime;
+
+    // Options
+    bool adjustValues;
+    bool adjustTimes;
+    bool adjustTangentAngles;
+    bool adjustTangentWeights;
+    bool forceWholeFrames;
+    bool addKeys;
+    bool streamed;
+
+    // Set to stop the solve, may be NULL.
+    const std::atomic<bool> *cancel;
+
+    // Early exit; 'deadline' is a 'debug::get_timestamp' time, 0 and
+    // zero targets are disabled. 'stopped' is set once any is reached.
+    debug::Timestamp deadline;
+    double targetRmsError;
+    double targetMaxError;
+    bool stopped;
+
+    // Parameters are solved scaled, with an offset and scale per
+    // parameter class (time, value, angles and weights), so every class
+    // has a similar magnitude whatever the curve's units; see
+    // 'scaleCurveParameter'. 'unscaledParams' is work memory.
+    double paramOffsets[kParamsPerKey];
+    double paramScales[kParamsPerKey];
+    std::vector<double> unscaledParams;
+
+    // Lowest error (sum of squares) evaluated by the current levmar
+    // run, and its (unscaled) parameters.
+    double bestError;
+    std::vector<double> bestParams;
+
+    // Residuals of the previous 'curveFunc' call. Keyframes
+    // 'changedFirstKey' to 'changedLastKey' have changed since (none
+    // when first > last), only samples near them are re-evaluated.
+    // Keyframes changed outside of 'setCurveParameters' must be marked
+    // with 'markCurveKeysChanged', or the cache invalidated.
+    std::vector<double> cacheResidual;
+    bool cacheValid;
+    int changedFirstKey;
+    int changedLastKey;
+};
+
+
+// Number of threads to run 'numTasks' independent solves on, at most
+// 'maxThreads' (one per core when zero). levmar built with linear
+// solvers that retain static memory between calls
+// (LINSOLVERS_RETAIN_MEMORY) is not thread-safe, so solves then run one
+// at a time.
+inline
+int solverThreadCount(int numTasks, int maxThreads) {
+#ifdef LINSOLVERS_RETAIN_MEMORY
+    return 1;
+#else
+    int numThreads = (int) std::thread::hardware_concurrency();
+    if (maxThreads > 0) {
+        numThreads = maxThreads;
+    }
+    return std::max(1, std::min(numThreads, numTasks));
+#endif
+}
+
+
+inline
+bool isCancelled(const std::atomic<bool> *cancel) {
+    return (cancel != NULL) && cancel->load(std::memory_order_relaxed);
+}
+
+
+// Has the solve's time budget run out?
+inline
+bool isPastDeadline(const CurveData &userData) {
+    return (userData.deadline != 0) && (debug::get_timestamp() >= userData.deadline);
+}
+
+
+// Should the solve stop early, with sample errors of 'error' (sum of
+// squares over 'n' samples) and 'maxError'?
+inline
+bool isSolveFinished(const CurveData &userData, double error, double maxError, int n) {
+    if ((userData.targetRmsError > 0.0) && (std::sqrt(error / double(n)) <= userData.targetRmsError)) {
+        return true;
+    }
+    if ((userData.targetMaxError > 0.0) && (maxError <= userData.targetMaxError)) {
+        return true;
+    }
+    return isPastDeadline(userData);
+}
+
+
+// Forget the cached residuals; all samples are evaluated next time.
+inline
+void invalidateResidualCache(CurveData &userData) {
+    userData.cacheValid = false;
+    userData.changedFirstKey = std::numeric_limits<int>::max();
+    userData.changedLastKey = -1;
+}
+
+
+// Keyframes 'first' to 'last' of the destination curve have changed
+// since the residuals were cached.
+inline
+void markCurveKeysChanged(CurveData &userData, int first, int last) {
+    userData.changedFirstKey = std::min(userData.changedFirstKey, first);
+    userData.changedLastKey = std::max(userData.changedLastKey, last);
+}
+
+
+// Set the destination curve keyframes from the parameters, and mark
+// the keyframes that changed.
+inline
+void setCurveParameters(const double *p, int m, CurveData *userData) {
+    CurveKeys &keys = *userData->dstKeys;
+    for (int i = 0; i < (m / kParamsPerKey); ++i) {
+        int k = userData->firstKey + i;
+        double t = p[(i * 6) + 0];  // time
+        double v = p[(i * 6) + 1];  // value
+        double it = p[(i * 6) + 2]; // in-tangent angle
+        double ot = p[(i * 6) + 3]; // out-tangent angle
+        double iw = p[(i * 6) + 4]; // in-tangent weight
+        double ow = p[(i * 6) + 5]; // out-tangent weight
+
+        bool changed = false;
+        if (userData->adjustTimes) {
+            if (userData->forceWholeFrames) {
+                t = roundToFrame(t);
+            }
+            t = std::max(userData->minKeyTime, std::min(t, userData->maxKeyTime));
+            changed = changed || (keys.times[k] != t);
+            keys.times[k] = t;
+        }
+        if (userData->adjustValues) {
+            changed = changed || (keys.values[k] != v);
+            keys.values[k] = v;
+        }
+        if (userData->adjustTangentAngles) {
+            changed = changed || (keys.inAngles[k] != it) || (keys.outAngles[k] != ot);
+            keys.inAngles[k] = it;
+            keys.outAngles[k] = ot;
+        }
+        if (userData->adjustTangentWeights) {
+            iw = std::max(kMinTangentWeight, std::min(iw, kMaxTangentWeight));
+            ow = std::max(kMinTangentWeight, std::min(ow, kMaxTangentWeight));
+            changed = changed || (keys.inWeights[k] != iw) || (keys.outWeights[k] != ow);
+            keys.inWeights[k] = iw;
+            keys.outWeights[k] = ow;
+        }
+        if (changed) {
+            markCurveKeysChanged(*userData, k, k);
+        }
+    }
+    if (userData->adjustTimes) {
+        // Keyframes moved apart from their neighbours changed too. Whole
+        // frame times are not solved by levmar (they are searched), so
+        // all the snapped keyframes are simply marked.
+        int lastKey = userData->firstKey + (m / kParamsPerKey) - 1;
+        if (userData->forceWholeFrames && snapCurveKeyTimes(keys, userData->firstKey, lastKey)) {
+            markCurveKeysChanged(*userData, userData->firstKey, lastKey);
+        } else {
+            int lastMoved = sortCurveKeyTimes(keys);
+            if (lastMoved >= 0) {
+                markCurveKeysChanged(*userData, userData->firstKey, lastMoved);
+            }
+        }
+    }
+}
+
+
+// Offsets and scales of the parameter classes, from the source time
+// range ('start' to 'end') and the sampled source values. Times and
+// values are scaled by their ranges, tangent angles by the slope of
+// the value range over the time range, and weights (the length of a
+// tangent, in seconds and value) by the size of an average segment.
+inline
+void setCurveParameterScales(CurveData &userData, double start, double end) {
+    const std::vector<double> &srcValues = *userData.srcValues;
+    double minValue = srcValues[0];
+    double maxValue = srcValues[0];
+    for (size_t i = 1; i < srcValues.size(); ++i) {
+        minValue = std::min(minValue, srcValues[i]);
+        maxValue = std::max(maxValue, srcValues[i]);
+    }
+    double timeRange = std::max(end - start, 1.0);
+    double valueRange = maxValue - minValue;
+    if (valueRange <= 0.0) {
+        valueRange = std::max(fabs(maxValue), 1.0);
+    }
+    // Tangent angles and weights are measured in value and seconds.
+    double seconds = timeRange / userData.dstKeys->framesPerSecond;
+    double slopeRange = valueRange / seconds;
+    double numSegments = std::max(double(userData.dstKeys->numKeys()) - 1.0, 1.0);
+    double weightRange = std::sqrt((seconds * seconds) + (valueRange * valueRange)) / numSegments;
+
+    for (int c = 0; c < kParamsPerKey; ++c) {
+        userData.paramOffsets[c] = 0.0;
+        userData.paramScales[c] = 1.0;
+    }
+    userData.paramOffsets[0] = start;
+    userData.paramScales[0] = timeRange;
+    userData.paramOffsets[1] = minValue;
+    userData.paramScales[1] = valueRange;
+    userData.paramScales[2] = slopeRange;
+    userData.paramScales[3] = slopeRange;
+    userData.paramScales[4] = weightRange;
+    userData.paramScales[5] = weightRange;
+}
+
+
+// Scaled value of parameter class 'c' (0 to kParamsPerKey - 1), and
+// back. Tangent angles are scaled as slopes, '(tan(angle) / scale)',
+// so the curve is linear in them (for unweighted curves), like values.
+inline
+double scaleCurveParameter(const CurveData &userData, int c, double value) {
+    if ((c == 2) || (c == 3)) {
+        return std::tan(value * (M_PI / 180.0)) / userData.paramScales[c];
+    }
+    return (value - userData.paramOffsets[c]) / userData.paramScales[c];
+}
+
+inline
+double unscaleCurveParameter(const CurveData &userData, int c, double x) {
+    if ((c == 2) || (c == 3)) {
+        return std::atan(x * userData.paramScales[c]) * (180.0 / M_PI);
+    }
+    return userData.paramOffsets[c] + (x * userData.paramScales[c]);
+}
+
+
+// Derivative of parameter class 'c' with respect to its scaled value,
+// at 'value' (unscaled).
+inline
+double curveParameterScale(const CurveData &userData, int c, double value) {
+    if ((c == 2) || (c == 3)) {
+        double cosAngle = std::cos(value * (M_PI / 180.0));
+        return (180.0 / M_PI) * userData.paramScales[c] * cosAngle * cosAngle;
+    }
+    return userData.paramScales[c];
+}
+
+
+// Convert 'm' parameters to ('scaleCurveParameters') and from
+// ('unscaleCurveParameters') the scaled parameters solved by levmar.
+inline
+void scaleCurveParameters(const CurveData &userData, const double *p, int m, double *x) {
+    for (int i = 0; i < m; ++i) {
+        x[i] = scaleCurveParameter(userData, i % kParamsPerKey, p[i]);
+    }
+}
+
+inline
+void unscaleCurveParameters(const CurveData &userData, const double *x, int m, double *p) {
+    for (int i = 0; i < m; ++i) {
+        p[i] = unscaleCurveParameter(userData, i % kParamsPerKey, x[i]);
+    }
+}
+
+
+// Set the destination curve keyframes from scaled parameters.
+inline
+void setScaledCurveParameters(const double *x, int m, CurveData *userData) {
+    userData->unscaledParams.resize(m);
+    unscaleCurveParameters(*userData, x, m, &userData->unscaledParams[0]);
+    setCurveParameters(&userData->unscaledParams[0], m, userData);
+}
+
+
+// Get the parameters from the destination curve keyframes
+// 'firstKey' to 'lastKey'.
+inline
+void getCurveParameters(const CurveKeys &keys, int firstKey, int lastKey, double *p) {
+    for (int i = 0; i <= (lastKey - firstKey); ++i) {
+        int k = firstKey + i;
+        p[(i * 6) + 0] = keys.times[k];      // time
+        p[(i * 6) + 1] = keys.values[k];     // value
+        p[(i * 6) + 2] = keys.inAngles[k];   // in-tangent angle
+        p[(i * 6) + 3] = keys.outAngles[k];  // out-tangent angle
+        p[(i * 6) + 4] = keys.inWeights[k];  // in-tangent weight
+        p[(i * 6) + 5] = keys.outWeights[k]; // out-tangent weight
+    }
+}
+
+
+// Error of a single sample. Levmar squares and sums the errors, so the
+// signed difference is used; the solved error is then the sum of
+// squared differences, the same as the direct linear solve.
+inline
+double sampleResidual(double srcValue, double dstValue) {
+    return srcValue - dstValue;
+}
+
+
+// Bring the cached residuals up to date with the destination
+// keyframes; only the samples next to changed keyframes are evaluated.
+// A keyframe only changes the segments either side of it, or the
+// extrapolated curve for the first and last keyframes, and the
+// keyframes just outside the changed range have not moved. Returns the
+// number of samples evaluated.
+inline
+int updateResidualCache(CurveData &userData) {
+    const CurveKeys &keys = *userData.dstKeys;
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    const std::vector<double> &srcValues = *userData.srcValues;
+    std::vector<double> &residual = userData.cacheResidual;
+    int numKeys = (int) keys.numKeys();
+    int n = (int) sampleTimes.size();
+    int first = 0;
+    int last = n;
+    if (userData.cacheValid && ((int) residual.size() == n)) {
+        int firstKey = userData.changedFirstKey;
+        int lastKey = userData.changedLastKey;
+        first = n;
+        last = n;
+        if (firstKey <= lastKey) {
+            first = 0;
+            if (firstKey > 0) {
+                first = (int) (std::lower_bound(sampleTimes.begin(), sampleTimes.end(), keys.times[firstKey - 1])
+                               - sampleTimes.begin());
+            }
+            if (lastKey < (numKeys - 1)) {
+                last = (int) (std::upper_bound(sampleTimes.begin(), sampleTimes.end(), keys.times[lastKey + 1])
+                              - sampleTimes.begin());
+            }
+        }
+    } else {
+        residual.resize(n);
+    }
+
+    for (int i = first; i < last; ++i) {
+        double dstValue = evaluateCurve(keys, sampleTimes[i]);
+        residual[i] = sampleResidual(srcValues[i], dstValue);
+    }
+    invalidateResidualCache(userData);
+    userData.cacheValid = true;
+    return last - first;
+}
+
+
+// Sum of squared residuals.
+inline
+double residualError(const std::vector<double> &residual) {
+    double error = 0.0;
+    for (size_t i = 0; i < residual.size(); ++i) {
+        error += residual[i] * residual[i];
+    }
+    return error;
+}
+
+
+// Root-mean-square sample error, from the sum of squared residuals of
+// 'n' samples. This is the error returned by a solve, it does not
+// depend on the number of samples or on how the solve was done.
+inline
+double rmsError(double sumSquares, int n) {
+    return std::sqrt(sumSquares / double(std::max(n, 1)));
+}
+
+
+// Function run by lev-mar algorith to test the input parameters, p, and compute the output errors, x.
+//
+// While levmar builds the finite-difference Jacobian it changes one
+// parameter per call, so only the samples next to one keyframe change;
+// the other residuals are copied from the previous call.
+inline
+void curveFunc(double *p, double *x, int m, int n, void *data) {
+    debug::TraceScope trace("residual");
+    CurveData *userData = (CurveData *) data;
+
+    // Invalid errors make levmar stop (reason 7).
+    if (isCancelled(userData->cancel) || userData->stopped) {
+        for (int i = 0; i < n; ++i) {
+            x[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+        return;
+    }
+
+    // Set curve using (scaled) parameters.
+    setScaledCurveParameters(p, m, userData);
+
+    // Calculate
+    int evaluated = updateResidualCache(*userData);
+    if (evaluated < n) {
+        trace.setName("jacobian");
+    }
+    trace.setArg("samples", double(evaluated));
+    const std::vector<double> &residual = userData->cacheResidual;
+    std::copy(residual.begin(), residual.end(), x);
+
+    // Remember the best parameters, a stopped solve returns them.
+    double error = 0.0;
+    double maxError = 0.0;
+    for (int i = 0; i < n; ++i) {
+        error += x[i] * x[i];
+        maxError = std::max(maxError, fabs(x[i]));
+    }
+    if (error < userData->bestError) {
+        userData->bestError = error;
+        userData->bestParams = userData->unscaledParams;
+    }
+    if (isSolveFinished(*userData, error, maxError, n)) {
+        userData->stopped = true;
+        for (int i = 0; i < n; ++i) {
+            x[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+}
+
+
+// Sample and per destination segment errors of a solved curve.
+struct ErrorReport {
+    // Error returned by the solve.
+    double error;
+
+    // Absolute error of each sample.
+    std::vector<double> sampleTimes;
+    std::vector<double> sampleErrors;
+
+    // Maximum and RMS sample error of each segment between two
+    // destination keyframes; samples outside the keyframes count
+    // towards the first or last segment.
+    std::vector<double> segmentMaxErrors;
+    std::vector<double> segmentRmsErrors;
+
+    // Covariance of each destination keyframe's parameters, a
+    // kParamsPerKey x kParamsPerKey block (row-major) per keyframe;
+    // only set when 'SolverOptions::covariance' is enabled.
+    std::vector<double> keyCovariance;
+};
+
+
+// Fill 'report' from the residuals of the samples at 'sampleTimes'.
+inline
+void makeErrorReport(const std::vector<double> &sampleTimes,
+                     const std::vector<double> &residual,
+                     const CurveKeys &keys,
+                     double error,
+                     ErrorReport &report) {
+    int numSegments = std::max((int) keys.numKeys() - 1, 1);
+    report.error = error;
+    report.sampleTimes = sampleTimes;
+    report.sampleErrors.resize(residual.size());
+    report.segmentMaxErrors.assign(numSegments, 0.0);
+    report.segmentRmsErrors.assign(numSegments, 0.0);
+    std::vector<int> counts(numSegments, 0);
+    for (size_t i = 0; i < residual.size(); ++i) {
+        double sampleError = fabs(residual[i]);
+        int k = findCurveSegment(keys, sampleTimes[i]);
+        k = std::max(0, std::min(k, numSegments - 1));
+        report.sampleErrors[i] = sampleError;
+        report.segmentMaxErrors[k] = std::max(report.segmentMaxErrors[k], sampleError);
+        report.segmentRmsErrors[k] += sampleError * sampleError;
+        counts[k] += 1;
+    }
+    for (int k = 0; k < numSegments; ++k) {
+        if (counts[k] > 0) {
+            report.segmentRmsErrors[k] = std::sqrt(report.segmentRmsErrors[k] / double(counts[k]));
+        }
+    }
+}
+
+
+// Source matched by the solver, either an animCurve's keyframes or
+// sampled (baked) values; exactly one is set.
+struct CurveSource {
+    CurveSource() : keys(NULL), samples(NULL) {}
+
+    const CurveKeys *keys;
+    const CurveSamples *samples;
+
+    double startTime() const {
+        return keys ? keys->times[0] : samples->times[0];
+    }
+
+    double endTime() const {
+        return keys ? keys->times[keys->numKeys() - 1] : samples->times[samples->numSamples() - 1];
+    }
+
+    double evaluate(double t) const {
+        return keys ? evaluateCurve(*keys, t) : evaluateCurveSamples(*samples, t);
+    }
+};
+
+
+// Sample the source inside the time range 'rangeStart' to 'rangeEnd'.
+// Keyframes are sampled 'n' times, evenly spaced between the first and
+// last source keyframes; sampled sources use their own samples. If
+// fewer than 'minSamples' samples are inside the range, the range is
+// re-sampled evenly with 'minSamples' samples.
+inline
+void sampleCurve(const CurveSource &source,
+                 int n,
+                 double rangeStart,
+                 double rangeEnd,
+                 int minSamples,
+                 std::vector<double> &sampleTimes,
+                 std::vector<double> &srcValues) {
+    sampleTimes.clear();
+    srcValues.clear();
+    if (source.samples != NULL) {
+        const CurveSamples &samples = *source.samples;
+        for (unsigned int i = 0; i < samples.numSamples(); ++i) {
+            double t = samples.times[i];
+            if ((t >= rangeStart) && (t <= rangeEnd)) {
+                sampleTimes.push_back(t);
+                srcValues.push_back(samples.values[i]);
+            }
+        }
+    } else {
+        double start = source.startTime();
+        double end = source.endTime();
+        double step = (end - start) / double(n);
+        for (int i = 0; i < n; ++i) {
+            double t = start + (double(i) * step);
+            if ((t >= rangeStart) && (t <= rangeEnd)) {
+                sampleTimes.push_back(t);
+            }
+        }
+        srcValues.resize(sampleTimes.size());
+        for (size_t i = 0; i < sampleTimes.size(); ++i) {
+            srcValues[i] = source.evaluate(sampleTimes[i]);
+        }
+    }
+
+    if ((int) sampleTimes.size() < minSamples) {
+        double step = (rangeEnd - rangeStart) / double(minSamples);
+        sampleTimes.resize(minSamples);
+        srcValues.resize(minSamples);
+        for (int i = 0; i < minSamples; ++i) {
+            sampleTimes[i] = rangeStart + (double(i) * step);
+            srcValues[i] = source.evaluate(sampleTimes[i]);
+        }
+    }
+}
+
+
+// Is parameter 'c' (0 to kParamsPerKey - 1) of each keyframe solved?
+inline
+bool isCurveParameterSolved(const CurveData &userData, int c) {
+    switch (c) {
+        case 0:
+            return userData.adjustTimes;
+        case 1:
+            return userData.adjustValues;
+        case 2:
+        case 3:
+            return userData.adjustTangentAngles;
+        default:
+            break;
+    }
+    return userData.adjustTangentWeights;
+}
+
+
+// Keyframe attribute of parameter 'c' (see 'getCurveParameters').
+inline
+double &curveKeyParameter(CurveKeys &keys, int k, int c) {
+    switch (c) {
+        case 0:
+            return keys.times[k];
+        case 1:
+            return keys.values[k];
+        case 2:
+            return keys.inAngles[k];
+        case 3:
+            return keys.outAngles[k];
+        case 4:
+            return keys.inWeights[k];
+        default:
+            break;
+    }
+    return keys.outWeights[k];
+}
+
+
+// Sum of squared sample errors of the destination keyframes, and the
+// maximum absolute sample error. No residuals are stored.
+inline
+double streamedCurveError(const CurveData &userData, double &maxError) {
+    const CurveKeys &keys = *userData.dstKeys;
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    const std::vector<double> &srcValues = *userData.srcValues;
+    double error = 0.0;
+    maxError = 0.0;
+    for (size_t i = 0; i < sampleTimes.size(); ++i) {
+        double x = sampleResidual(srcValues[i], evaluateCurve(keys, sampleTimes[i]));
+        error += x * x;
+        maxError = std::max(maxError, fabs(x));
+    }
+    return error;
+}
+
+
+// Accumulate the normal equations of the 'm' scaled parameters, J^T J
+// into 'normal' and J^T e into 'gradient', without storing the
+// Jacobian. Samples are processed in blocks inside a single curve
+// segment, so only the parameters of the (at most 2) keyframes of the
+// segment are differentiated, by central differences of step 'delta'
+// in scaled parameters (or larger, relative to the parameter). Returns
+// the sum of squared sample errors.
+inline
+double accumulateStreamedNormals(CurveData &userData,
+                                 int m,
+                                 double delta,
+                                 BandedMatrix &normal,
+                                 std::vector<double> &gradient,
+                                 double &maxError) {
+    TRACE_SCOPE("accumulateNormals");
+    CurveKeys &keys = *userData.dstKeys;
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    const std::vector<double> &srcValues = *userData.srcValues;
+    const int n = (int) sampleTimes.size();
+    const int numKeys = (int) keys.numKeys();
+    normal.resize(m, kStreamBandwidth);
+    gradient.assign(m, 0.0);
+
+    double residual[kStreamBlockSize];
+    double plus[kStreamBlockSize];
+    double columns[kStreamParams][kStreamBlockSize];
+    int columnParams[kStreamParams];
+    double error = 0.0;
+    maxError = 0.0;
+    int i = 0;
+    while (i < n) {
+        // The block ends at the block size, or the next keyframe.
+        int segment = findCurveSegment(keys, sampleTimes[i]);
+        int end = std::min(n, i + kStreamBlockSize);
+        if ((segment + 1) < numKeys) {
+            std::vector<double>::const_iterator it;
+            it = std::lower_bound(sampleTimes.begin() + i, sampleTimes.begin() + end, keys.times[segment + 1]);
+            end = std::max(i + 1, (int) (it - sampleTimes.begin()));
+        }
+        int num = end - i;
+
+        for (int j = 0; j < num; ++j) {
+            residual[j] = sampleResidual(srcValues[i + j], evaluateCurve(keys, sampleTimes[i + j]));
+            error += residual[j] * residual[j];
+            maxError = std::max(maxError, fabs(residual[j]));
+        }
+
+        // Derivatives of the solved parameters of the segment keyframes.
+        int numColumns = 0;
+        int firstKey = std::max(std::max(segment, 0), userData.firstKey);
+        int lastKey = std::min(std::min(segment + 1, numKeys - 1), userData.lastKey);
+        for (int k = firstKey; k <= lastKey; ++k) {
+            for (int c = 0; c < kParamsPerKey; ++c) {
+                if (!isCurveParameterSolved(userData, c)) {
+                    continue;
+                }
+                double &attr = curveKeyParameter(keys, k, c);
+                double value = attr;
+                double scaled = scaleCurveParameter(userData, c, value);
+                double step = std::max(fabs(scaled) * 1.0E-4, delta);
+                double high = unscaleCurveParameter(userData, c, scaled + step);
+                double low = unscaleCurveParameter(userData, c, scaled - step);
+                if (c >= 4) {
+                    high = std::min(high, kMaxTangentWeight);
+                    low = std::max(low, kMinTangentWeight);
+                } else if (c == 0) {
+                    // Keyframe times may not pass their neighbours.
+                    double prev = (k > 0) ? (keys.times[k - 1] + kMinKeySpacing) : userData.minKeyTime;
+                    double next = (k < (numKeys - 1)) ? (keys.times[k + 1] - kMinKeySpacing) : userData.maxKeyTime;
+                    high = std::max(value, std::min(high, std::min(next, userData.maxKeyTime)));
+                    low = std::min(value, std::max(low, std::max(prev, userData.minKeyTime)));
+                }
+
+                double *column = columns[numColumns];
+                attr = high;
+                for (int j = 0; j < num; ++j) {
+                    plus[j] = evaluateCurve(keys, sampleTimes[i + j]);
+                }
+                attr = low;
+                double width = scaleCurveParameter(userData, c, high) - scaleCurveParameter(userData, c, low);
+                for (int j = 0; j < num; ++j) {
+                    double minus = evaluateCurve(keys, sampleTimes[i + j]);
+                    column[j] = (high > low) ? ((plus[j] - minus) / width) : 0.0;
+                }
+                attr = value;
+                columnParams[numColumns] = ((k - userData.firstKey) * kParamsPerKey) + c;
+                numColumns += 1;
+            }
+        }
+
+        // The residual is 'src - dst', so J^T e of the destination
+        // curve is the descent direction.
+        for (int a = 0; a < numColumns; ++a) {
+            double g = 0.0;
+            for (int j = 0; j < num; ++j) {
+                g += columns[a][j] * residual[j];
+            }
+            gradient[columnParams[a]] += g;
+            for (int b = a; b < numColumns; ++b) {
+                double sum = 0.0;
+                for (int j = 0; j < num; ++j) {
+                    sum += columns[a][j] * columns[b][j];
+                }
+                normal.add(columnParams[a], columnParams[b], sum);
+            }
+        }
+        i = end;
+    }
+    return error;
+}
+
+
+// Levenberg-Marquardt solve like 'runCurveSolve', with the normal
+// equations accumulated directly from the samples. The Jacobian (n * m
+// doubles) and levmar's work memory are never allocated, the banded
+// normal equations only need memory for the parameters. Uses the same
+// stopping thresholds and 'info' layout as levmar; 'params' are scaled.
+inline
+int runStreamedCurveSolve(CurveData &userData,
+                          double *params,
+                          int m,
+                          int n,
+                          int iterMax,
+                          double mu,
+                          double *info) {
+    debug::TraceScope trace("streamedSolve");
+    const double delta = kDiffDelta;
+    const double minGradient = 1E-15;
+    const double minStep = 1E-15;
+    const double minError = 1E-20;
+    for (int i = 0; i < LM_INFO_SZ; ++i) {
+        info[i] = 0.0;
+    }
+
+    std::vector<bool> solved(m);
+    for (int i = 0; i < m; ++i) {
+        solved[i] = isCurveParameterSolved(userData, i % kParamsPerKey);
+    }
+
+    std::vector<double> p(params, params + m);
+    std::vector<double> trial(m);
+    std::vector<double> step(m);
+    std::vector<double> gradient(m);
+    BandedMatrix normal;
+    BandedMatrix system;
+
+    setScaledCurveParameters(&p[0], m, &userData);
+    double maxError = 0.0;
+    double error = accumulateStreamedNormals(userData, m, delta, normal, gradient, maxError);
+    int numFunc = 1;
+    int numJacobian = 1;
+    int numSystems = 0;
+    info[0] = error;
+    double maxDiagonal = 0.0;
+    for (int i = 0; i < m; ++i) {
+        if (solved[i]) {
+            maxDiagonal = std::max(maxDiagonal, normal.at(i, i));
+        }
+    }
+    mu *= (maxDiagonal > 0.0) ? maxDiagonal : 1.0;
+    double nu = 2.0;
+    double stepNorm = 0.0;
+    int iterations = 0;
+    int reason = 3;
+    while (true) {
+        if (isCancelled(userData.cancel)) {
+            return -1;
+        }
+        if (isSolveFinished(userData, error, maxError, n)) {
+            userData.stopped = true;
+            break;
+        }
+        double gradientMax = 0.0;
+        for (int i = 0; i < m; ++i) {
+            gradientMax = std::max(gradientMax, fabs(gradient[i]));
+        }
+        info[2] = gradientMax;
+        if (gradientMax <= minGradient) {
+            reason = 1;
+            break;
+        }
+        if (error <= minError) {
+            reason = 6;
+            break;
+        }
+        if (iterations >= iterMax) {
+            reason = 3;
+            break;
+        }
+
+        // Damped normal equations, parameters that are not solved
+        // do not move.
+        system = normal;
+        for (int i = 0; i < m; ++i) {
+            if (solved[i]) {
+                system.at(i, i) += mu;
+            } else {
+                system.at(i, i) = 1.0;
+            }
+        }
+        numSystems += 1;
+        bool accepted = false;
+        if (factorBandedLDLT(system)) {
+            step = gradient;
+            solveBandedLDLT(system, step);
+            double paramNorm = 0.0;
+            stepNorm = 0.0;
+            for (int i = 0; i < m; ++i) {
+                trial[i] = p[i] + step[i];
+                int c = i % kParamsPerKey;
+                if (c == 0) {
+                    // Project keyframe times back inside their range,
+                    // a time moved past it would not change the curve.
+                    double lower = scaleCurveParameter(userData, c, userData.minKeyTime);
+                    double upper = scaleCurveParameter(userData, c, userData.maxKeyTime);
+                    trial[i] = std::max(lower, std::min(trial[i], upper));
+                    step[i] = trial[i] - p[i];
+                } else if (c >= 4) {
+                    // Project tangent weights back inside their bounds.
+                    double lower = scaleCurveParameter(userData, c, kMinTangentWeight);
+                    double upper = scaleCurveParameter(userData, c, kMaxTangentWeight);
+                    trial[i] = std::max(lower, std::min(trial[i], upper));
+                    step[i] = trial[i] - p[i];
+                }
+                paramNorm += p[i] * p[i];
+                stepNorm += step[i] * step[i];
+            }
+            if (std::sqrt(stepNorm) <= (minStep * std::sqrt(paramNorm))) {
+                reason = 2;
+                break;
+            }
+
+            setScaledCurveParameters(&trial[0], m, &userData);
+            double trialMaxError = 0.0;
+            double trialError = streamedCurveError(userData, trialMaxError);
+            numFunc += 1;
+            double predicted = 0.0;
+            for (int i = 0; i < m; ++i) {
+                predicted += step[i] * ((mu * step[i]) + gradient[i]);
+            }
+            double gain = (error - trialError) / predicted;
+            if ((predicted > 0.0) && (gain > 0.0) && std::isfinite(trialError)) {
+                double g = (2.0 * gain) - 1.0;
+                mu *= std::max(1.0 / 3.0, 1.0 - (g * g * g));
+                nu = 2.0;
+                p = trial;
+                iterations += 1;
+                error = accumulateStreamedNormals(userData, m, delta, normal, gradient, maxError);
+                numJacobian += 1;
+                accepted = true;
+            }
+        }
+        if (!accepted) {
+            setScaledCurveParameters(&p[0], m, &userData);
+            mu *= nu;
+            nu *= 2.0;
+            if (nu > kMaxStreamDamping) {
+                reason = 5;
+                break;
+            }
+        }
+    }
+
+    std::copy(p.begin(), p.end(), params);
+    setScaledCurveParameters(params, m, &userData);
+    info[1] = error;
+    info[3] = stepNorm;
+    info[4] = mu / std::max(maxDiagonal, 1.0E-300);
+    info[5] = double(iterations);
+    info[6] = double(reason);
+    info[7] = double(numFunc);
+    info[8] = double(numJacobian);
+    info[9] = double(numSystems);
+    trace.setArg("iterations", info[5]);
+    return iterations;
+}
+
+
+// Estimate the covariance of the solved keyframe parameters at the
+// current keyframes, sigma^2 (J^T J)^-1, with sigma^2 the error per
+// degree of freedom. Only the diagonal block of each keyframe is
+// computed, by solving the banded normal equations for the block's
+// columns; the dense m x m inverse is never formed. Fixed keyframes
+// and parameters have zero covariance. Returns false if the normal
+// equations are singular.
+inline
+bool estimateKeyCovariance(CurveData &userData, std::vector<double> &covariance) {
+    TRACE_SCOPE("covariance");
+    const int numKeys = (int) userData.dstKeys->numKeys();
+    const int blockSize = kParamsPerKey * kParamsPerKey;
+    const int m = ((userData.lastKey - userData.firstKey) + 1) * kParamsPerKey;
+    const int n = (int) userData.sampleTimes->size();
+    covariance.assign(numKeys * blockSize, 0.0);
+
+    BandedMatrix normal;
+    std::vector<double> gradient;
+    double maxError = 0.0;
+    double error = accumulateStreamedNormals(userData, m, kDiffDelta, normal, gradient, maxError);
+
+    // Parameters no sample depends on are held by a small damping, like
+    // the direct solve, and get a very large variance. The normal
+    // equations are of the scaled parameters.
+    std::vector<bool> solved(m);
+    int numSolved = 0;
+    double maxDiagonal = 0.0;
+    for (int i = 0; i < m; ++i) {
+        solved[i] = isCurveParameterSolved(userData, i % kParamsPerKey);
+        if (solved[i]) {
+            numSolved += 1;
+            maxDiagonal = std::max(maxDiagonal, normal.at(i, i));
+        }
+    }
+    double damping = 1.0e-10 * std::max(maxDiagonal, 1.0);
+    for (int i = 0; i < m; ++i) {
+        normal.at(i, i) = solved[i] ? (normal.at(i, i) + damping) : 1.0;
+    }
+    if (!factorBandedLDLT(normal)) {
+        WRN("Keyframe covariance normal equations are singular.");
+        return false;
+    }
+    double variance = error / double(std::max(n - numSolved, 1));
+
+    std::vector<double> column(m);
+    for (int i = 0; i < m; ++i) {
+        if (!solved[i]) {
+            continue;
+        }
+        column.assign(m, 0.0);
+        column[i] = 1.0;
+        solveBandedLDLT(normal, column);
+
+        // Back from scaled to keyframe parameters.
+        int key = i / kParamsPerKey;
+        int c = i % kParamsPerKey;
+        CurveKeys &keys = *userData.dstKeys;
+        double scaleC = curveParameterScale(userData, c, curveKeyParameter(keys, userData.firstKey + key, c));
+        double *block = &covariance[(userData.firstKey + key) * blockSize];
+        for (int r = 0; r < kParamsPerKey; ++r) {
+            int j = (key * kParamsPerKey) + r;
+            if (solved[j]) {
+                double scaleR = curveParameterScale(userData, r, curveKeyParameter(keys, userData.firstKey + key, r));
+                block[(r * kParamsPerKey) + c] = column[j] * variance * scaleR * scaleC;
+            }
+        }
+    }
+    return true;
+}
+
+
+// Run a single levmar solve, 'params' are modified in-place. Levmar
+// solves the scaled parameters.
+inline
+int runCurveSolve(CurveData &userData,
+                  double *params,
+                  int m,
+                  int n,
+                  int iterMax,
+                  double mu,
+                  double *info) {
+    // The keyframes may have been changed since the last solve.
+    invalidateResidualCache(userData);
+    userData.bestError = std::numeric_limits<double>::max();
+    userData.bestParams.clear();
+    std::vector<double> scaled(m);
+    scaleCurveParameters(userData, params, m, &scaled[0]);
+    if (userData.streamed) {
+        int ret = runStreamedCurveSolve(userData, &scaled[0], m, n, iterMax, mu, info);
+        unscaleCurveParameters(userData, &scaled[0], m, params);
+        return ret;
+    }
+    debug::TraceScope trace("levmar");
+
+    // Standard Lev-Mar arguments.
+    double opts[LM_OPTS_SZ];
+
+    // Options
+    // NOTE: The diff delta is in scaled parameters, a small part of
+    // each parameter's range.
+    opts[0] = mu;
+    opts[1] = 1E-15;
+    opts[2] = 1E-15;
+    opts[3] = 1E-20;
+    opts[4] = -kDiffDelta;
+
+    // Tangent weights are solved with box constraints, keeping them
+    // inside their bounds. The dense covariance is not computed, see
+    // 'estimateKeyCovariance'.
+    bool bounded = userData.adjustTangentWeights;
+    int workSize = bounded ? LM_BC_DIF_WORKSZ(m, n) : LM_DIF_WORKSZ(m, n);
+    double *work = (double *) malloc(workSize * sizeof(double));
+    if (!work) {
+        ERR("Memory allocation request failed.");
+        return -1;
+    }
+
+    int ret = -1;
+    if (bounded) {
+        const double unbounded = std::numeric_limits<double>::max();
+        std::vector<double> lower(m, -unbounded);
+        std::vector<double> upper(m, unbounded);
+        for (int i = 0; i < m; ++i) {
+            int c = i % kParamsPerKey;
+            if (c >= 4) {
+                lower[i] = scaleCurveParameter(userData, c, kMinTangentWeight);
+                upper[i] = scaleCurveParameter(userData, c, kMaxTangentWeight);
+            }
+        }
+
+        // The same arguments as 'dlevmar_dif' below, with the lower and
+        // upper parameter bounds, and no diagonal scaling.
+        ret = dlevmar_bc_dif(curveFunc,
+                             &scaled[0],
+                             NULL,
+                             m,
+                             n,
+                             &lower[0],
+                             &upper[0],
+                             NULL,
+                             iterMax,
+                             opts,
+                             info,
+                             work,
+                             NULL,
+                             (void *) &userData);
+    } else {
+        // no Jacobian, caller allocates work memory, no covariance
+        ret = dlevmar_dif(
+
+                // Function to call (input only)
+                // Function must be of the structure:
+                //   func(double *params, double *x, int m, int n, void *data)
+                curveFunc,
+
+                // Parameters (input and output)
+                // Should be filled with initial estimate, will be filled
+                // with output parameters
+                &scaled[0],
+
+                // Measurement Vector (input only)
+                // NULL implies a zero vector
+                NULL,
+
+                // Parameter Vector Dimension (input only)
+                // (i.e. #unknowns)
+                m,
+
+                // Measurement Vector Dimension (input only)
+                n,
+
+                // Maximum Number of Iterations (input only)
+                iterMax,
+
+                // Minimisation options (input only)
+                // opts[0] = tau      (scale factor for initialTransform mu)
+                // opts[1] = epsilon1 (stopping threshold for ||J^T e||_inf)
+                // opts[2] = epsilon2 (stopping threshold for ||Dp||_2)
+                // opts[3] = epsilon3 (stopping threshold for ||e||_2)
+                // opts[4] = delta    (step used in difference approximation to the Jacobian)
+                //
+                // If \delta<0, the Jacobian is approximated with central differences
+                // which are more accurate (but slower!) compared to the forward
+                // differences employed by default.
+                // Set to NULL for defaults to be used.
+                opts,
+
+                // Output Information (output only)
+                // information regarding the minimization.
+                // info[0] = ||e||_2 at initialTransform params.
+                // info[1-4] = (all computed at estimated params)
+                //  [
+                //   ||e||_2,
+                //   ||J^T e||_inf,
+                //   ||Dp||_2,
+                //   \mu/max[J^T J]_ii
+                //  ]
+                // info[5] = number of iterations,
+                // info[6] = reason for terminating:
+                //   1 - stopped by small gradient J^T e
+                //   2 - stopped by small Dp
+                //   3 - stopped by iterMax
+                //   4 - singular matrix. Restart from current params with increased \mu
+                //   5 - no further error reduction is possible. Restart with increased mu
+                //   6 - stopped by small ||e||_2
+                //   7 - stopped by invalid (i.e. NaN or Inf) "func" refPoints; a user error
+                // info[7] = number of function evaluations
+                // info[8] = number of Jacobian evaluations
+                // info[9] = number linear systems solved (number of attempts for reducing error)
+                //
+                // Set to NULL if don't care
+                info,
+
+                // Working Data (input only)
+                // working memory, allocated internally if NULL. If !=NULL, it is assumed to
+                // point to a memory chunk at least LM_DIF_WORKSZ(m, n)*sizeof(double) bytes
+                // long
+                work,
+
+                // Covariance matrix (output only)
+                // Covariance matrix corresponding to LS solution; Assumed to point to a mxm matrix.
+                // Set to NULL if not needed.
+                NULL,
+
+                // Custom Data for 'func' (input only)
+                // pointer to possibly needed additional data, passed uninterpreted to func.
+                // Set to NULL if not needed
+                (void *) &userData);
+    }
+
+    free(work);
+    unscaleCurveParameters(userData, &scaled[0], m, params);
+    trace.setArg("iterations", info[5]);
+
+    // A solve stopped by the time budget or target error is not a
+    // failure; use the best parameters evaluated.
+    if (userData.stopped && !isCancelled(userData.cancel)) {
+        ret = (int) info[5];
+    }
+    if (!userData.bestParams.empty() && (userData.stopped || (userData.bestError < info[1]))) {
+        std::copy(userData.bestParams.begin(), userData.bestParams.end(), params);
+        info[1] = userData.bestError;
+    }
+    return ret;
+}
+
+
+// Levmar gave up, but restarting with a larger mu may still reduce the error.
+inline
+bool isSolveStalled(const double *info) {
+    int reasonNum = (int) info[6];
+    return (reasonNum == 4) || (reasonNum == 5);
+}
+
+
+// A single (re-)start of the solver, each start owns its own keyframes.
+struct SolveStart {
+    CurveKeys keys;
+    std::vector<double> params;
+    double mu;
+    double info[LM_INFO_SZ];
+    int ret;
+    bool stopped;
+};
+
+
+// Create restart number 'index' from the stalled parameters. Every
+// start uses a larger mu, odd starts re-space the keyframe times
+// evenly (when adjusting times) and later starts also jitter the
+// values and tangent angles.
+inline
+void makeRestart(const CurveKeys &stalledKeys,
+                 const std::vector<double> &stalledParams,
+                 const SolverOptions &options,
+                 double valueRange,
+                 int index,
+                 SolveStart &start) {
+    start.keys = stalledKeys;
+    start.params = stalledParams;
+    start.mu = kInitialMu * std::pow(10.0, double(index + 1));
+    start.ret = -1;
+    start.stopped = false;
+
+    // Times are only re-spaced when all keyframes are solved.
+    unsigned int numKeys = (unsigned int) (stalledParams.size() / kParamsPerKey);
+    bool allKeys = numKeys == start.keys.numKeys();
+    if (options.adjustTimes && allKeys && ((index % 2) == 1) && (numKeys > 2)) {
+        double first = stalledParams[0];
+        double last = stalledParams[((numKeys - 1) * 6) + 0];
+        for (unsigned int i = 1; i < (numKeys - 1); ++i) {
+            double t = first + ((last - first) * (double(i) / double(numKeys - 1)));
+            if (options.forceWholeFrames) {
+                t = roundToFrame(t);
+            }
+            start.params[(i * 6) + 0] = t;
+        }
+    }
+
+    if (index >= 2) {
+        std::mt19937 generator((unsigned int) index);
+        std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+        double amount = 0.005 * double(index);
+        for (unsigned int i = 0; i < numKeys; ++i) {
+            if (options.adjustValues) {
+                start.params[(i * 6) + 1] += jitter(generator) * amount * valueRange;
+            }
+            if (options.adjustTangentAngles) {
+                start.params[(i * 6) + 2] += jitter(generator) * amount * 90.0;
+                start.params[(i * 6) + 3] += jitter(generator) * amount * 90.0;
+            }
+        }
+    }
+}
+
+
+inline
+void runRestart(SolveStart *start,
+                const CurveData *baseData,
+                int n,
+                int iterMax) {
+    TRACE_SCOPE("restart");
+    CurveData userData = *baseData;
+    userData.dstKeys = &start->keys;
+    int m = (int) start->params.size();
+    start->ret = runCurveSolve(userData, &start->params[0], m, n, iterMax, start->mu, start->info);
+    start->stopped = userData.stopped;
+}
+
+
+// Worker thread, runs restarts until none are left.
+inline
+void runRestarts(std::vector<SolveStart> *starts,
+                 std::atomic<int> *next,
+                 const CurveData *baseData,
+                 int n,
+                 int iterMax) {
+    int numStarts = (int) starts->size();
+    for (int k = (*next)++; k < numStarts; k = (*next)++) {
+        runRestart(&(*starts)[k], baseData, n, iterMax);
+    }
+}
+
+
+// Sum of squared sample errors for the samples inside (start, end).
+inline
+double sampleRangeCost(const CurveData &userData, double start, double end) {
+    const CurveKeys &keys = *userData.dstKeys;
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    const std::vector<double> &srcValues = *userData.srcValues;
+    std::vector<double>::const_iterator it;
+    it = std::upper_bound(sampleTimes.begin(), sampleTimes.end(), start);
+    double cost = 0.0;
+    for (size_t i = it - sampleTimes.begin(); i < sampleTimes.size(); ++i) {
+        if (sampleTimes[i] >= end) {
+            break;
+        }
+        double x = sampleResidual(srcValues[i], evaluateCurve(keys, sampleTimes[i]));
+        cost += x * x;
+    }
+    return cost;
+}
+
+
+// Move keyframe times by whole frames, one key at a time, while the
+// error reduces. Values and tangents are kept fixed. Moving a key only
+// changes the samples between its two neighbours, so only those are
+// evaluated. Keys stay between their neighbours, inside the solved
+// time range and inside the source range. When 'keepEndKeys' is true
+// the first and last keyframes are not moved. Returns true if any
+// keyframe time changed.
+inline
+bool searchWholeFrameTimes(CurveData &userData, bool keepEndKeys) {
+    TRACE_SCOPE("wholeFrameSearch");
+    CurveKeys &keys = *userData.dstKeys;
+    int numKeys = (int) keys.numKeys();
+    const double lowest = -std::numeric_limits<double>::max();
+    const double highest = std::numeric_limits<double>::max();
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    double minTime = userData.minKeyTime;
+    double maxTime = userData.maxKeyTime;
+    if (!sampleTimes.empty()) {
+        minTime = std::max(minTime, sampleTimes.front());
+        maxTime = std::min(maxTime, sampleTimes.back());
+    }
+    int firstKey = std::max(userData.firstKey, keepEndKeys ? 1 : 0);
+    int lastKey = std::min(userData.lastKey, keepEndKeys ? (numKeys - 2) : (numKeys - 1));
+    bool changed = false;
+    for (int sweep = 0; sweep < kMaxWholeFrameSweeps; ++sweep) {
+        bool moved = false;
+        for (int k = firstKey; k <= lastKey; ++k) {
+            double prev = (k > 0) ? keys.times[k - 1] : lowest;
+            double next = (k < (numKeys - 1)) ? keys.times[k + 1] : highest;
+            double time = keys.times[k];
+            double bestTime = time;
+            double bestCost = sampleRangeCost(userData, prev, next);
+            for (int step = -1; step <= 1; step += 2) {
+                double t = time + double(step);
+                if ((t <= prev) || (t >= next) || (t < minTime) || (t > maxTime)) {
+                    continue;
+                }
+                keys.times[k] = t;
+                double cost = sampleRangeCost(userData, prev, next);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestTime = t;
+                }
+            }
+            keys.times[k] = bestTime;
+            if (bestTime != time) {
+                markCurveKeysChanged(userData, k, k);
+                moved = true;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+
+// Can the parameters be solved by linear least squares? Only values
+// and tangent slopes of unweighted curves are linear, times and
+// weights are not.
+inline
+bool isCurveLinear(const CurveData &userData) {
+    return !userData.adjustTimes
+           && !userData.adjustTangentWeights
+           && !userData.dstKeys->weighted
+           && (userData.adjustValues || userData.adjustTangentAngles);
+}
+
+
+// Solve the key values and tangents directly, by linear least squares
+// of the sample errors. Unknowns that are not adjusted are kept at
+// their current values. Returns the number of samples used, or -1 if
+// the normal equations are singular.
+inline
+int solveCurveDirect(CurveData &userData,
+                     std::vector<double> &params,
+                     int n,
+                     double *info) {
+    TRACE_SCOPE("directSolve");
+    CurveKeys &keys = *userData.dstKeys;
+    const std::vector<double> &sampleTimes = *userData.sampleTimes;
+    const std::vector<double> &srcValues = *userData.srcValues;
+    const int num = (int) keys.numKeys();
+    const int size = num * kLinearUnknownsPerKey;
+
+    std::vector<double> unknowns;
+    getCurveUnknowns(keys, unknowns);
+    std::vector<bool> solved(size, false);
+    for (int k = userData.firstKey; k <= userData.lastKey; ++k) {
+        solved[(k * kLinearUnknownsPerKey) + 0] = userData.adjustValues;
+        solved[(k * kLinearUnknownsPerKey) + 1] = userData.adjustTangentAngles;
+        solved[(k * kLinearUnknownsPerKey) + 2] = userData.adjustTangentAngles;
+    }
+
+    // Normal equations, the fixed unknowns are moved to the right
+    // hand side.
+    BandedMatrix normal;
+    normal.resize(size, kCurveBandwidth);
+    std::vector<double> rhs(size, 0.0);
+    int indices[4];
+    double coeffs[4];
+    for (int i = 0; i < n; ++i) {
+        int terms = curveSampleBasis(keys, sampleTimes[i], indices, coeffs);
+        double r = srcValues[i];
+        for (int a = 0; a < terms; ++a) {
+            if (!solved[indices[a]]) {
+                r -= coeffs[a] * unknowns[indices[a]];
+            }
+        }
+        for (int a = 0; a < terms; ++a) {
+            if (!solved[indices[a]]) {
+                continue;
+            }
+            rhs[indices[a]] += coeffs[a] * r;
+            for (int b = a; b < terms; ++b) {
+                if (solved[indices[b]]) {
+                    normal.add(indices[a], indices[b], coeffs[a] * coeffs[b]);
+                }
+            }
+        }
+    }
+
+    // Unknowns no sample depends on (for example the in-tangent of the
+    // first key, with constant extrapolation) are held by a small pull
+    // towards their current value.
+    double maxDiagonal = 0.0;
+    for (int i = 0; i < size; ++i) {
+        maxDiagonal = std::max(maxDiagonal, normal.at(i, i));
+    }
+    double damping = 1.0e-10 * std::max(maxDiagonal, 1.0);
+    for (int i = 0; i < size; ++i) {
+        if (solved[i]) {
+            normal.at(i, i) += damping;
+            rhs[i] += damping * unknowns[i];
+        } else {
+            normal.at(i, i) = 1.0;
+            rhs[i] = unknowns[i];
+        }
+    }
+
+    updateResidualCache(userData);
+    double initialError = residualError(userData.cacheResidual);
+    if (!factorBandedLDLT(normal)) {
+        return -1;
+    }
+    solveBandedLDLT(normal, rhs);
+    setCurveUnknowns(rhs, solved, keys);
+    markCurveKeysChanged(userData, userData.firstKey, userData.lastKey);
+    getCurveParameters(keys, userData.firstKey, userData.lastKey, &params[0]);
+
+    for (int i = 0; i < LM_INFO_SZ; ++i) {
+        info[i] = 0.0;
+    }
+    info[0] = initialError;
+    updateResidualCache(userData);
+    info[1] = residualError(userData.cacheResidual);
+    info[6] = kDirectSolveReason;
+    return n;
+}
+
+
+// Solve the parameters with levmar, restarting from perturbed starts
+// if levmar stalls. Returns the levmar return value.
+inline
+int solveCurveParameters(CurveData &userData,
+                         std::vector<double> &params,
+                         int n,
+                         const SolverOptions &options,
+                         double *info) {
+    int m = (int) params.size();
+
+    // With fixed times the exact solution is found directly, levmar is
+    // only used to polish it.
+    if (options.directSolve && isCurveLinear(userData)) {
+        setCurveParameters(&params[0], m, &userData);
+        int ret = solveCurveDirect(userData, params, n, info);
+        if (ret != -1) {
+            LOG_DEBUG("Direct solve error: " << info[1]);
+            if (options.polishIterations <= 0) {
+                return ret;
+            }
+            double initialError = info[0];
+            ret = runCurveSolve(userData, &params[0], m, n, options.polishIterations, kInitialMu, info);
+            if (ret != -1) {
+                info[0] = initialError;
+                setCurveParameters(&params[0], m, &userData);
+            }
+            return ret;
+        }
+        LOG_DEBUG("Direct solve is singular, solving with levmar.");
+    }
+
+    int ret = runCurveSolve(userData, &params[0], m, n, options.iterMax, kInitialMu, info);
+    if (ret == -1) {
+        return ret;
+    }
+    LOG_DEBUG("Levenberg-Marquardt returned " << ret << " in " << (int) info[5]
+                                              << " iterations");
+
+    // Restart from the stalled solution, with several different
+    // starting points, and keep the best.
+    bool restart = isSolveStalled(info) && !userData.stopped && !isCancelled(options.cancel);
+    if (restart && (options.restarts > 0)) {
+        const std::vector<double> &srcValues = *userData.srcValues;
+        double minValue = srcValues[0];
+        double maxValue = srcValues[0];
+        for (int i = 1; i < n; ++i) {
+            minValue = std::min(minValue, srcValues[i]);
+            maxValue = std::max(maxValue, srcValues[i]);
+        }
+
+        setCurveParameters(&params[0], m, &userData);
+        std::vector<SolveStart> starts(options.restarts);
+        for (int k = 0; k < options.restarts; ++k) {
+            makeRestart(*userData.dstKeys, params, options, maxValue - minValue, k, starts[k]);
+        }
+
+        // The calling thread runs restarts too.
+        std::atomic<int> next(0);
+        int numThreads = solverThreadCount(options.restarts, options.maxThreads);
+        std::vector<std::thread> threads;
+        for (int i = 1; i < numThreads; ++i) {
+            threads.push_back(std::thread(runRestarts, &starts, &next, &userData, n, options.iterMax));
+        }
+        runRestarts(&starts, &next, &userData, n, options.iterMax);
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+
+        int best = -1;
+        double bestError = info[1];
+        for (int k = 0; k < options.restarts; ++k) {
+            userData.stopped = userData.stopped || starts[k].stopped;
+            if ((starts[k].ret != -1) && (starts[k].info[1] < bestError)) {
+                best = k;
+                bestError = starts[k].info[1];
+            }
+        }
+
+        // The result is the winning restart's, only the initial error
+        // stays that of the first solve.
+        if (best >= 0) {
+            params = starts[best].params;
+            ret = starts[best].ret;
+            double initialError = info[0];
+            std::copy(starts[best].info, starts[best].info + LM_INFO_SZ, info);
+            info[0] = initialError;
+            LOG_INFO("Restart " << best << " (mu=" << starts[best].mu << ") improved the error to: " << info[1]);
+        }
+    }
+
+    // Keep the destination curve in sync with the solved parameters.
+    setCurveParameters(&params[0], m, &userData);
+    return ret;
+}
+
+
+// Ranges of the keyframes within 'neighbourhood' keyframes of each of
+// 'changedKeys', as (first, last) pairs for 'SolverOptions::keyRanges'.
+// Overlapping or touching ranges are merged.
+inline
+void makeKeyRanges(std::vector<int> changedKeys,
+                   int neighbourhood,
+                   int numKeys,
+                   std::vector<int> &ranges) {
+    ranges.clear();
+    std::sort(changedKeys.begin(), changedKeys.end());
+    for (size_t i = 0; i < changedKeys.size(); ++i) {
+        int first = std::max(changedKeys[i] - neighbourhood, 0);
+        int last = std::min(changedKeys[i] + neighbourhood, numKeys - 1);
+        if (first > last) {
+            continue;
+        }
+        if (!ranges.empty() && (first <= (ranges.back() + 1))) {
+            ranges.back() = std::max(ranges.back(), last);
+        } else {
+            ranges.push_back(first);
+            ranges.push_back(last);
+        }
+    }
+}
+
+
+// RMS error of the destination curve over the source samples that
+// keyframes 'firstKey' to 'lastKey' change, without solving. The sample
+// errors are written to 'outReport', if given.
+inline
+double measureCurveKeyError(const CurveSource &source,
+                            const CurveKeys &dstKeys,
+                            int firstKey,
+                            int lastKey,
+                            ErrorReport *outReport) {
+    int numKeys = (int) dstKeys.numKeys();
+    double start = source.startTime();
+    double end = source.endTime();
+    double rangeStart = (firstKey > 0) ? std::max(start, dstKeys.times[firstKey - 1]) : start;
+    double rangeEnd = (lastKey < (numKeys - 1)) ? std::min(end, dstKeys.times[lastKey + 1]) : end;
+    int n = std::max(int(end) - int(start), 1);
+
+    std::vector<double> sampleTimes;
+    std::vector<double> srcValues;
+    sampleCurve(source, n, rangeStart, rangeEnd, 1, sampleTimes, srcValues);
+    std::vector<double> residual(sampleTimes.size());
+    for (size_t i = 0; i < sampleTimes.size(); ++i) {
+        residual[i] = sampleResidual(srcValues[i], evaluateCurve(dstKeys, sampleTimes[i]));
+    }
+    double error = rmsError(residualError(residual), (int) residual.size());
+    if (outReport != NULL) {
+        makeErrorReport(sampleTimes, residual, dstKeys, error, *outReport);
+    }
+    return error;
+}
+
+
+// Solve the destination keyframes to match the source. 'outError' is
+// the RMS sample error, and the sample errors of the solved curve are
+// written to 'outReport', if given.
+inline
+bool solveCurveSource(const CurveSource &source,
+                      CurveKeys &dstKeys,
+                      const SolverOptions &options,
+                      double &outError,
+                      ErrorReport *outReport) {
+    // The time budget covers all passes below.
+    if ((options.timeBudget > 0.0) && (options.deadline == 0)) {
+        SolverOptions budgetOptions = options;
+        budgetOptions.deadline = debug::get_timestamp() + (debug::Timestamp) (options.timeBudget * 1000000.0);
+        return solveCurveSource(source, dstKeys, budgetOptions, outError, outReport);
+    }
+
+    // Solving weights needs a weighted curve. An unweighted curve is
+    // solved without weights first, then converted without changing
+    // its shape, so the weights are solved from the best unweighted fit.
+    // Converting changes every keyframe, so a partial solve cannot do it.
+    if (options.adjustTangentWeights && !dstKeys.weighted) {
+        int lastKey = (int) dstKeys.numKeys() - 1;
+        bool partial = (options.firstKey > 0) || ((options.lastKey >= 0) && (options.lastKey < lastKey));
+        if (!options.keyRanges.empty()) {
+            partial = (options.keyRanges.size() != 2) || (options.keyRanges[0] > 0)
+                      || (options.keyRanges[1] < lastKey);
+        }
+        if (partial) {
+            ERR("Tangent weights cannot be solved on part of an unweighted curve, make the curve weighted first.");
+            return false;
+        }
+        SolverOptions hermiteOptions = options;
+        hermiteOptions.adjustTangentWeights = false;
+        if (!solveCurveSource(source, dstKeys, hermiteOptions, outError, NULL)) {
+            return false;
+        }
+        makeCurveKeysWeighted(dstKeys);
+        SolverOptions weightOptions = options;
+        weightOptions.scaleTimeKeys = false;
+        return solveCurveSource(source, dstKeys, weightOptions, outError, outReport);
+    }
+
+    int ret;
+    // TODO: Try adding new keys to reduce the error, if this is required. This would require a second loop
+    unsigned int dstNumKeys = dstKeys.numKeys();
+    assert(dstNumKeys >= 2);
+
+    // Solve each range of keyframes on its own, then measure the error
+    // over the samples of all the ranges.
+    if (!options.keyRanges.empty()) {
+        const std::vector<int> &ranges = options.keyRanges;
+        SolverOptions rangeOptions = options;
+        rangeOptions.keyRanges.clear();
+        std::vector<double> keyCovariance;
+        for (size_t i = 0; (i + 1) < ranges.size(); i += 2) {
+            LOG_DEBUG("Solving keyframe range: " << ranges[i] << " to " << ranges[i + 1]);
+            rangeOptions.firstKey = ranges[i];
+            rangeOptions.lastKey = ranges[i + 1];
+            ErrorReport rangeReport;
+            if (!solveCurveSource(source, dstKeys, rangeOptions, outError, outReport ? &rangeReport : NULL)) {
+                return false;
+            }
+            // Each range only has covariance blocks for its own keyframes.
+            keyCovariance.resize(rangeReport.keyCovariance.size(), 0.0);
+            for (size_t j = 0; j < rangeReport.keyCovariance.size(); ++j) {
+                keyCovariance[j] += rangeReport.keyCovariance[j];
+            }
+        }
+        outError = measureCurveKeyError(source, dstKeys, ranges.front(), ranges.back(), outReport);
+        if (outReport != NULL) {
+            outReport->keyCovariance = keyCovariance;
+        }
+        return true;
+    }
+
+    // Range of solved keyframes, the other keyframes are kept fixed.
+    int firstKey = std::max(options.firstKey, 0);
+    int lastKey = (int) dstNumKeys - 1;
+    if ((options.lastKey >= 0) && (options.lastKey < lastKey)) {
+        lastKey = options.lastKey;
+    }
+    if (firstKey > lastKey) {
+        ERR("Keyframe range to solve is empty.");
+        return false;
+    }
+    bool allKeys = (firstKey == 0) && (lastKey == ((int) dstNumKeys - 1));
+
+    // Number of unknown parameters.
+    const int m = ((lastKey - firstKey) + 1) * kParamsPerKey;
+    std::vector<double> params(m);
+
+    // Number of measurement errors. (Must be less than unknown parameters).
+    // This is the number of integer frames between the
+    // start and end frames of the source curve
+    double start = source.startTime();
+    double end = source.endTime();
+    int frames = int(end) - int(start);
+    if (frames < m) {
+        // Ensure the number of unknowns is equal or greater than number of errors.
+        frames = m;
+    }
+    int n = frames;
+
+    // Stretch out the curves to align to the source start/end key
+    // frames. A partial solve keeps the fixed keyframes where they are.
+    if (options.scaleTimeKeys && allKeys) {
+        TRACE_SCOPE("scaleTimeKeys");
+        scaleCurveKeyTimes(start, end, dstKeys, options.forceWholeFrames);
+    }
+
+    // A cycled infinity makes samples outside the keyframes depend on
+    // keyframes at the other end of the curve, which the solver cannot
+    // handle.
+    bool moveFirst = options.adjustTimes && (firstKey == 0);
+    bool moveLast = options.adjustTimes && (lastKey == ((int) dstNumKeys - 1));
+    if ((isCyclicInfinity(dstKeys.preInfinity) && (moveFirst || (dstKeys.times[0] > start)))
+        || (isCyclicInfinity(dstKeys.postInfinity) && (moveLast || (dstKeys.times[dstNumKeys - 1] < end)))) {
+        ERR("Destination curve infinity cannot be cycle or oscillate inside the source range, "
+            "use constant or linear infinity.");
+        return false;
+    }
+
+    // Only the samples between the fixed neighbours of the solved
+    // keyframes can change; the end keyframes also change the
+    // extrapolated curve, up to the source start/end.
+    double rangeStart = start;
+    double rangeEnd = end;
+    if (firstKey > 0) {
+        rangeStart = std::max(start, dstKeys.times[firstKey - 1]);
+    }
+    if (lastKey < ((int) dstNumKeys - 1)) {
+        rangeEnd = std::min(end, dstKeys.times[lastKey + 1]);
+    }
+
+    // The source curve does not change, sample it only once.
+    std::vector<double> sampleTimes;
+    std::vector<double> srcValues;
+    {
+        TRACE_SCOPE("sampleSource");
+        sampleCurve(source, n, rangeStart, rangeEnd, m, sampleTimes, srcValues);
+    }
+    n = (int) sampleTimes.size();
+    LOG_DEBUG("m=" << m);
+    LOG_DEBUG("n=" << n);
+    assert(m <= n);
+
+    // Whole frame times make the error piecewise constant in time, so
+    // levmar cannot see a gradient. Key times are searched separately,
+    // in whole frames, alternating with solves of the other parameters.
+    SolverOptions solveOptions = options;
+    bool wholeFrameTimes = options.adjustTimes && options.forceWholeFrames;
+    if (wholeFrameTimes) {
+        solveOptions.adjustTimes = false;
+        if (!snapCurveKeyTimes(dstKeys, firstKey, lastKey)) {
+            ERR("Not enough whole frames between the fixed keyframes for the solved keyframes.");
+            return false;
+        }
+    }
+
+    struct CurveData userData;
+    userData.sampleTimes = &sampleTimes;
+    userData.srcValues = &srcValues;
+    userData.dstKeys = &dstKeys;
+    userData.firstKey = firstKey;
+    userData.lastKey = lastKey;
+    userData.minKeyTime = -std::numeric_limits<double>::max();
+    userData.maxKeyTime = std::numeric_limits<double>::max();
+    if (firstKey > 0) {
+        userData.minKeyTime = dstKeys.times[firstKey - 1] + kMinKeySpacing;
+    }
+    if (lastKey < ((int) dstNumKeys - 1)) {
+        userData.maxKeyTime = dstKeys.times[lastKey + 1] - kMinKeySpacing;
+    }
+    userData.adjustValues = solveOptions.adjustValues;
+    userData.adjustTimes = solveOptions.adjustTimes;
+    userData.adjustTangentAngles = solveOptions.adjustTangentAngles;
+    userData.adjustTangentWeights = solveOptions.adjustTangentWeights;
+    userData.forceWholeFrames = solveOptions.forceWholeFrames;
+    userData.addKeys = solveOptions.addKeys;
+    userData.streamed = solveOptions.streamed;
+    userData.cancel = solveOptions.cancel;
+    invalidateResidualCache(userData);
+    userData.deadline = options.deadline;
+    userData.targetRmsError = options.targetRmsError;
+    userData.targetMaxError = options.targetMaxError;
+    userData.stopped = false;
+    userData.bestError = std::numeric_limits<double>::max();
+    setCurveParameterScales(userData, start, end);
+
+    // Set Initial parameters
+    getCurveParameters(dstKeys, firstKey, lastKey, &params[0]);
+    debug::logValues("Initial Parameters:", &params[0], m);
+
+    double info[LM_INFO_SZ];
+    ret = solveCurveParameters(userData, params, n, solveOptions, info);
+    if ((ret == -1) || isCancelled(options.cancel)) {
+        return false;
+    }
+    double initialError = info[0];
+
+    if (wholeFrameTimes) {
+        for (int round = 0; round < kMaxWholeFrameRounds; ++round) {
+            if (userData.stopped || isPastDeadline(userData)) {
+                break;
+            }
+            if (!searchWholeFrameTimes(userData, options.scaleTimeKeys && allKeys)) {
+                break;
+            }
+            LOG_DEBUG("Whole frame time search round " << round << " moved keyframes.");
+            getCurveParameters(dstKeys, firstKey, lastKey, &params[0]);
+            ret = solveCurveParameters(userData, params, n, solveOptions, info);
+            if ((ret == -1) || isCancelled(options.cancel)) {
+                return false;
+            }
+        }
+    }
+
+    int reasonNum = (int) info[6];
+    if (userData.stopped) {
+        LOG_INFO("Termination Reason: stopped early, the time budget or target error was reached");
+    } else {
+        LOG_INFO("Termination Reason: " << reasons[reasonNum]);
+    }
+    LOG_INFO("Initial Error: " << initialError);
+    LOG_INFO("Overall Error: " << info[1]);
+
+    getCurveParameters(dstKeys, firstKey, lastKey, &params[0]);
+    debug::logValues("Solved Parameters:", &params[0], m);
+
+    LOG_DEBUG("J^T Error: " << info[2]);
+    LOG_DEBUG("Dp Error: " << info[3]);
+    LOG_DEBUG("Max Error: " << info[4]);
+    LOG_DEBUG("Function Evaluations: " << info[7]);
+    LOG_DEBUG("Jacobian Evaluations: " << info[8]);
+    LOG_DEBUG("Attempts for reducing error: " << info[9]);
+
+    outError = rmsError(info[1], n);
+
+    // The residuals of the solved keyframes are (mostly) cached already.
+    if (outReport != NULL) {
+        updateResidualCache(userData);
+        makeErrorReport(sampleTimes, userData.cacheResidual, dstKeys, outError, *outReport);
+        if (options.covariance) {
+            userData.adjustTimes = options.adjustTimes;
+            estimateKeyCovariance(userData, outReport->keyCovariance);
+        }
+    }
+    return true;
+}
+
+
+// Solve the destination keyframes to match the source curve.
+inline
+bool solveCurveKeys(const CurveKeys &srcKeys,
+                    CurveKeys &dstKeys,
+                    const SolverOptions &options,
+                    double &outError,
+                    ErrorReport *outReport = NULL) {
+    assert(srcKeys.numKeys() >= 2);
+    CurveSource source;
+    source.keys = &srcKeys;
+    return solveCurveSource(source, dstKeys, options, outError, outReport);
+}
+
+
+// Solve the destination keyframes to match sampled (baked) values.
+inline
+bool solveCurveSamples(const CurveSamples &srcSamples,
+                       CurveKeys &dstKeys,
+                       const SolverOptions &options,
+                       double &outError,
+                       ErrorReport *outReport = NULL) {
+    if (srcSamples.numSamples() < 2) {
+        ERR("At least 2 source samples are needed.");
+        return false;
+    }
+    CurveSource source;
+    source.samples = &srcSamples;
+    return solveCurveSource(source, dstKeys, options, outError, outReport);
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_SOLVER_H
@@ -0,0 +1,296 @@
+/*
+ * Key count sweep, finds the fewest destination keyframes that match
+ * the source within an error tolerance.
+ *
+ * A candidate curve is created for each key count, with keyframes
+ * placed where the source curves the most, and the candidates are
+ * solved in parallel, smallest first. Once a candidate is within the
+ * tolerance, all larger candidates are cancelled.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_SWEEP_H
+#define MAYA_ANIM_CURVE_MATCH_SWEEP_H
+
+// STL
+#include <cmath>               // sqrt, fabs, floor
+#include <vector>              // vector
+#include <atomic>              // atomic
+#include <thread>              // thread
+#include <mutex>               // mutex, unique_lock
+#include <chrono>              // milliseconds
+#include <memory>              // unique_ptr
+#include <condition_variable>  // condition_variable
+
+// Utils
+#include <utilities/debugUtils.h>
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+
+
+// Part of the average source curvature added everywhere, so flat
+// parts of the source still get some keyframes.
+const double kCurvatureFloor = 0.25;
+
+// How often (milliseconds) a running sweep checks for cancellation.
+const int kSweepPollInterval = 10;
+
+
+// Create 'numKeys' keyframes spanning the source, placed so each
+// segment covers an equal share of the source curvature. Values and
+// tangents are taken from the source. With 'forceWholeFrames' keyframes
+// rounded onto the same frame are merged, so fewer keyframes may be
+// created; returns the number created.
+inline
+unsigned int placeCurveKeys(const CurveSource &source,
+                            unsigned int numKeys,
+                            bool forceWholeFrames,
+                            double framesPerSecond,
+                            CurveKeys &keys) {
+    double start = source.startTime();
+    double end = source.endTime();
+    int numSamples = std::max(int(end - start) + 1, (int) (numKeys * 2));
+    double step = (end - start) / double(numSamples - 1);
+
+    std::vector<double> values(numSamples);
+    for (int i = 0; i < numSamples; ++i) {
+        values[i] = source.evaluate(start + (double(i) * step));
+    }
+
+    // Keyframe density, the square root of the curvature.
+    std::vector<double> density(numSamples, 0.0);
+    double total = 0.0;
+    for (int i = 1; i < (numSamples - 1); ++i) {
+        double curvature = fabs(values[i + 1] - (2.0 * values[i]) + values[i - 1]) / (step * step);
+        density[i] = std::sqrt(curvature);
+        total += density[i];
+    }
+    double minDensity = (kCurvatureFloor * (total / double(numSamples))) + 1.0e-12;
+    std::vector<double> cumulative(numSamples, 0.0);
+    for (int i = 1; i < numSamples; ++i) {
+        cumulative[i] = cumulative[i - 1] + (0.5 * (density[i - 1] + density[i])) + minDensity;
+    }
+
+    std::vector<double> times(1, start);
+    int i = 1;
+    for (unsigned int k = 1; k < (numKeys - 1); ++k) {
+        double target = cumulative[numSamples - 1] * (double(k) / double(numKeys - 1));
+        while ((i < (numSamples - 1)) && (cumulative[i] < target)) {
+            ++i;
+        }
+        double u = (target - cumulative[i - 1]) / (cumulative[i] - cumulative[i - 1]);
+        double t = start + ((double(i - 1) + u) * step);
+        if (forceWholeFrames) {
+            t = std::floor(t + 0.5);
+        }
+        if ((t > times.back()) && (t < end)) {
+            times.push_back(t);
+        }
+    }
+    times.push_back(end);
+
+    numKeys = (unsigned int) times.size();
+    keys.resize(numKeys);
+    keys.framesPerSecond = framesPerSecond;
+    keys.preInfinity = source.keys ? source.keys->preInfinity : kInfinityConstant;
+    keys.postInfinity = source.keys ? source.keys->postInfinity : kInfinityConstant;
+    keys.weighted = false;
+    keys.times = times;
+
+    const double h = 0.5;
+    for (unsigned int k = 0; k < numKeys; ++k) {
+        double t = keys.times[k];
+        double slope = (source.evaluate(t + h) - source.evaluate(t - h)) / (2.0 * h);
+        keys.values[k] = source.evaluate(t);
+        keys.inAngles[k] = slopeToAngle(slope, framesPerSecond);
+        keys.outAngles[k] = slopeToAngle(slope, framesPerSecond);
+    }
+    return numKeys;
+}
+
+
+// A solve of one key count.
+struct SweepCandidate {
+    SweepCandidate() :
+            numKeys(0),
+            ret(false),
+            error(-1.0),
+            maxError(-1.0),
+            cancel(false) {}
+
+    unsigned int numKeys;
+    CurveKeys keys;
+    bool ret;
+    double error;
+    double maxError;
+    std::atomic<bool> cancel;
+};
+
+
+// Shared state of the sweep worker threads.
+struct SweepState {
+    const CurveSource *source;
+    SolverOptions options;
+    double tolerance;
+    double framesPerSecond;
+    std::vector<std::unique_ptr<SweepCandidate> > candidates;
+
+    // Next candidate to solve, and the smallest candidate within the
+    // tolerance (or the number of candidates, if none is yet).
+    std::atomic<int> next;
+    std::atomic<int> winner;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    int numRunning;
+};
+
+
+// Worker thread, solves candidates (smallest first) until none are left.
+inline
+void runSweepWorker(SweepState *state) {
+    int numCandidates = (int) state->candidates.size();
+    for (int c = state->next++; c < numCandidates; c = state->next++) {
+        SweepCandidate &candidate = *state->candidates[c];
+        if ((c > state->winner.load()) || candidate.cancel.load()) {
+            continue;
+        }
+        TRACE_SCOPE("sweepCandidate");
+        unsigned int numKeys = placeCurveKeys(*state->source,
+                                              candidate.numKeys,
+                                              state->options.forceWholeFrames,
+                                              state->framesPerSecond,
+                                              candidate.keys);
+        if (numKeys < candidate.numKeys) {
+            // Too few distinct frames, a smaller candidate covers it.
+            LOG_DEBUG("Sweep " << candidate.numKeys << " keyframes skipped, only "
+                               << numKeys << " distinct frames.");
+            continue;
+        }
+
+        SolverOptions options = state->options;
+        options.cancel = &candidate.cancel;
+        ErrorReport report;
+        candidate.ret = solveCurveSource(*state->source, candidate.keys, options, candidate.error, &report);
+        if (!candidate.ret || candidate.cancel.load()) {
+            candidate.ret = false;
+            continue;
+        }
+        candidate.maxError = 0.0;
+        for (size_t i = 0; i < report.sampleErrors.size(); ++i) {
+            candidate.maxError = std::max(candidate.maxError, report.sampleErrors[i]);
+        }
+        LOG_DEBUG("Sweep " << candidate.numKeys << " keyframes, maximum error: " << candidate.maxError);
+
+        // Cancel the larger candidates.
+        if (candidate.maxError <= state->tolerance) {
+            int winner = state->winner.load();
+            while ((c < winner) && !state->winner.compare_exchange_weak(winner, c)) {}
+            for (int j = c + 1; j < numCandidates; ++j) {
+                state->candidates[j]->cancel.store(true);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->numRunning -= 1;
+    state->finished.notify_all();
+}
+
+
+// Solve candidates with 'minKeys' to 'maxKeys' keyframes in parallel,
+// and return the fewest keyframes within 'tolerance' (maximum sample
+// error) in 'outKeys'. If no candidate is within the tolerance, the
+// candidate with the smallest maximum error is returned. Returns false
+// if cancelled or nothing could be solved.
+inline
+bool sweepCurveKeys(const CurveSource &source,
+                    unsigned int minKeys,
+                    unsigned int maxKeys,
+                    const SolverOptions &options,
+                    double tolerance,
+                    double framesPerSecond,
+                    CurveKeys &outKeys,
+                    double &outError) {
+    TRACE_SCOPE("sweep");
+    minKeys = std::max(minKeys, 2u);
+    if (options.forceWholeFrames) {
+        unsigned int frames = (unsigned int) (source.endTime() - source.startTime()) + 1;
+        maxKeys = std::min(maxKeys, frames);
+    }
+    if (maxKeys < minKeys) {
+        ERR("Key count sweep range is empty.");
+        return false;
+    }
+
+    SweepState state;
+    state.source = &source;
+    state.options = options;
+    state.options.scaleTimeKeys = false;
+    state.options.firstKey = 0;
+    state.options.lastKey = -1;
+    state.options.keyRanges.clear();
+    state.options.targetMaxError = tolerance;
+    // The candidates already use all cores.
+    state.options.restarts = 0;
+    // The time budget covers the whole sweep, not each candidate.
+    if ((options.timeBudget > 0.0) && (options.deadline == 0)) {
+        state.options.deadline = debug::get_timestamp() + (debug::Timestamp) (options.timeBudget * 1000000.0);
+    }
+    state.tolerance = tolerance;
+    state.framesPerSecond = framesPerSecond;
+    for (unsigned int k = minKeys; k <= maxKeys; ++k) {
+        state.candidates.push_back(std::unique_ptr<SweepCandidate>(new SweepCandidate()));
+        state.candidates.back()->numKeys = k;
+    }
+    int numCandidates = (int) state.candidates.size();
+    state.next.store(0);
+    state.winner.store(numCandidates);
+
+    int numThreads = solverThreadCount(numCandidates, options.maxThreads);
+    state.numRunning = numThreads;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.push_back(std::thread(runSweepWorker, &state));
+    }
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        while (state.numRunning > 0) {
+            state.finished.wait_for(lock, std::chrono::milliseconds(kSweepPollInterval));
+            if (isCancelled(options.cancel)) {
+                for (int c = 0; c < numCandidates; ++c) {
+                    state.candidates[c]->cancel.store(true);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        threads[i].join();
+    }
+    if (isCancelled(options.cancel)) {
+        return false;
+    }
+
+    int best = state.winner.load();
+    if (best >= numCandidates) {
+        best = -1;
+        for (int c = 0; c < numCandidates; ++c) {
+            const SweepCandidate &candidate = *state.candidates[c];
+            if (candidate.ret && ((best < 0) || (candidate.maxError < state.candidates[best]->maxError))) {
+                best = c;
+            }
+        }
+        if (best < 0) {
+            return false;
+        }
+        LOG_INFO("No key count is within the tolerance, using the smallest error.");
+    }
+
+    outKeys = state.candidates[best]->keys;
+    outError = state.candidates[best]->maxError;
+    LOG_INFO("Key count sweep chose " << outKeys.numKeys() << " keyframes, maximum error: " << outError);
+    return true;
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_SWEEP_H
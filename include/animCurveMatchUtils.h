@@ -1,447 +1,505 @@
 /*
- * Uses Non-Linear Least Squares algorithm from levmar library to calculate animCurve attributes.
+ * Reads and writes Maya animCurves as 'CurveKeys' snapshots, bakes
+ * attributes into 'CurveSamples', and solves them with the levmar based
+ * solver.
  */
 
 
 #ifndef MAYA_ANIM_CURVE_MATCH_UTILS_H
 #define MAYA_ANIM_CURVE_MATCH_UTILS_H
 
-// Lev-Mar
-#include <levmar.h>  //
-
 // STL
-#include <ctime>     // time
 #include <cmath>     // exp
-#include <iostream>  // cout, cerr, endl
-#include <string>    // string
 #include <vector>    // vector
-#include <cassert>   // assert
-#include <math.h>
+#include <algorithm> // max
 
 // Utils
 #include <utilities/debugUtils.h>
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+#include <animCurveMatchReduce.h>
+#include <animCurveMatchCache.h>
+#include <animCurveMatchSweep.h>
 
 // Maya
-#include <maya/MPoint.h>
-#include <maya/MVector.h>
+#include <maya/MStatus.h>
 #include <maya/MString.h>
 #include <maya/MObject.h>
+#include <maya/MTime.h>
+#include <maya/MAngle.h>
 #include <maya/MFnAnimCurve.h>
 #include <maya/MAnimCurveChange.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MPlug.h>
+#include <maya/MPlugArray.h>
+#include <maya/MDGContext.h>
+#include <maya/MFileIO.h>
 
 
-// Lev-Mar Termination Reasons:
-const std::string reasons[8] = {
-        // reason 0
-        "no reason, should not get here",
+// Copy the keyframes of an animCurve into 'keys'.
+inline
+MStatus readCurveKeys(MFnAnimCurve &curveFn, CurveKeys &keys) {
+    MStatus status;
+    unsigned int numKeys = curveFn.numKeys(&status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
 
-        // reason 1
-        "stopped by small gradient J^T e",
+    MTime::Unit unit = MTime::uiUnit();
+    keys.resize(numKeys);
+    keys.framesPerSecond = MTime(1.0, MTime::kSeconds).asUnits(unit);
+    for (unsigned int i = 0; i < numKeys; ++i) {
+        keys.times[i] = curveFn.time(i).asUnits(unit);
+        keys.values[i] = curveFn.value(i);
 
-        // reason 2
-        "stopped by small Dp",
+        // Tangents angle and weights
+        MAngle ia = 0;
+        MAngle oa = 0;
+        double iw = 1.0;
+        double ow = 1.0;
+        curveFn.getTangent(i, ia, iw, true);
+        curveFn.getTangent(i, oa, ow, false);
+        keys.inAngles[i] = ia.asDegrees();
+        keys.outAngles[i] = oa.asDegrees();
+        keys.inWeights[i] = iw;
+        keys.outWeights[i] = ow;
+    }
 
-        // reason 3
-        "stopped by itmax",
+    keys.weighted = curveFn.isWeighted();
+    keys.preInfinity = (int) curveFn.preInfinityType();
+    keys.postInfinity = (int) curveFn.postInfinityType();
+    return status;
+}
 
-        // reason 4
-        "singular matrix. Restart from current p with increased \\mu",
 
-        // reason 5
-        "no further error reduction is possible. Restart with increased mu",
+// Write 'keys' back onto an animCurve with the same number of keyframes.
+// Only keyframes 'firstKey' to 'lastKey' are set, a negative 'lastKey'
+// means the last keyframe. All changes are recorded in 'animChange' for
+// undo/redo.
+inline
+MStatus writeCurveKeys(MFnAnimCurve &curveFn,
+                       const CurveKeys &keys,
+                       int firstKey,
+                       int lastKey,
+                       bool setTimes,
+                       bool setValues,
+                       bool setTangentAngles,
+                       bool setTangentWeights,
+                       MAnimCurveChange *animChange) {
+    MStatus status;
+    unsigned int numKeys = curveFn.numKeys(&status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    if (numKeys != keys.numKeys()) {
+        ERR("animCurve keyframe count does not match the solved keyframes.");
+        return MStatus::kFailure;
+    }
+    unsigned int first = (unsigned int) std::max(firstKey, 0);
+    unsigned int last = numKeys - 1;
+    if ((lastKey >= 0) && ((unsigned int) lastKey < last)) {
+        last = (unsigned int) lastKey;
+    }
 
-        // reason 6
-        "stopped by small ||e||_2",
+    if (setTimes) {
+        // Move keys to earlier times first (forwards), then keys to
+        // later times (backwards), so no key ever passes a neighbour.
+        MTime::Unit unit = MTime::uiUnit();
+        for (unsigned int i = first; i <= last; ++i) {
+            if (keys.times[i] < curveFn.time(i).asUnits(unit)) {
+                status = curveFn.setTime(i, MTime(keys.times[i], unit), animChange);
+                CHECK_MSTATUS_AND_RETURN_IT(status);
+            }
+        }
+        for (int i = (int) last; i >= (int) first; --i) {
+            if (keys.times[i] > curveFn.time((unsigned int) i).asUnits(unit)) {
+                status = curveFn.setTime((unsigned int) i, MTime(keys.times[i], unit), animChange);
+                CHECK_MSTATUS_AND_RETURN_IT(status);
+            }
+        }
+    }
 
-        // reason 7
-        "stopped by invalid (i.e. NaN or Inf) \"func\" refPoints (user error)",
-};
+    // Weights only exist on weighted curves.
+    if (setTangentWeights && !curveFn.isWeighted()) {
+        status = curveFn.setIsWeighted(true, animChange);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
 
+    const MAngle::Unit degUnit = MAngle::kDegrees;
+    for (unsigned int i = first; i <= last; ++i) {
+        if (setValues) {
+            status = curveFn.setValue(i, keys.values[i], animChange);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+        }
+        if (setTangentAngles) {
+            // The in and out tangents are solved independently.
+            curveFn.setTangentsLocked(i, false, animChange);
+            status = curveFn.setAngle(i, MAngle(keys.inAngles[i], degUnit), true, animChange);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+            status = curveFn.setAngle(i, MAngle(keys.outAngles[i], degUnit), false, animChange);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+        }
+        if (setTangentWeights) {
+            curveFn.setWeightsLocked(i, false, animChange);
+            status = curveFn.setWeight(i, keys.inWeights[i], true, animChange);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+            status = curveFn.setWeight(i, keys.outWeights[i], false, animChange);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+        }
+    }
+
+    if (keys.preInfinity != kInfinityConstant) {
+        curveFn.setPreInfinityType((MFnAnimCurve::InfinityType) keys.preInfinity, animChange);
+    }
+    if (keys.postInfinity != kInfinityConstant) {
+        curveFn.setPostInfinityType((MFnAnimCurve::InfinityType) keys.postInfinity, animChange);
+    }
+    return status;
+}
 
-struct CurveData {
-    // TODO: Add data to this struct that does not need to be calculated in 'curveFunc'.
 
-    // Source and destination curves.
-    MFnAnimCurve *srcCurveFn;
-    MFnAnimCurve *dstCurveFn;
+// Replace all keyframes of an animCurve with 'keys'.
+inline
+MStatus replaceCurveKeys(MFnAnimCurve &curveFn,
+                         const CurveKeys &keys,
+                         MAnimCurveChange *animChange) {
+    MStatus status;
+    unsigned int numKeys = curveFn.numKeys(&status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    for (int i = (int) numKeys - 1; i >= 0; --i) {
+        status = curveFn.remove((unsigned int) i, animChange);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
 
-    // Storing changes for undo/redo.
-    MAnimCurveChange *animChange;
+    if (curveFn.isWeighted() != keys.weighted) {
+        status = curveFn.setIsWeighted(keys.weighted, animChange);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
 
-    // Options
-    bool adjustValues;
-    bool adjustTimes;
-    bool adjustTangentAngles;
-    bool adjustTangentWeights;
-    bool forceWholeFrames;
-    bool addKeys;
-};
+    MTime::Unit unit = MTime::uiUnit();
+    for (unsigned int i = 0; i < keys.numKeys(); ++i) {
+        curveFn.addKey(MTime(keys.times[i], unit),
+                       keys.values[i],
+                       MFnAnimCurve::kTangentFixed,
+                       MFnAnimCurve::kTangentFixed,
+                       animChange,
+                       &status);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
+    return writeCurveKeys(curveFn, keys, 0, -1, false, false, true, keys.weighted, animChange);
+}
 
 
-// Function run by lev-mar algorith to test the input parameters, p, and compute the output errors, x.
+// Write solved keyframes onto the destination animCurve. With
+// 'replaceKeys' all keyframes are replaced (the keyframe count may
+// differ), otherwise only the solved attributes are set.
 inline
-void curveFunc(double *p, double *x, int m, int n, void *data) {
-    register int i, j;
-    CurveData *userData = (CurveData *) data;
+MStatus applySolvedCurveKeys(MObject &dstCurve,
+                             const CurveKeys &keys,
+                             const SolverOptions &options,
+                             bool replaceKeys,
+                             MAnimCurveChange &animChange) {
+    TRACE_SCOPE("writeBack");
+    MStatus status;
+    MFnAnimCurve dstCurveFn(dstCurve, &status);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    if (replaceKeys) {
+        return replaceCurveKeys(dstCurveFn, keys, &animChange);
+    }
+    return writeCurveKeys(dstCurveFn,
+                          keys,
+                          options.firstKey,
+                          options.lastKey,
+                          options.adjustTimes || options.scaleTimeKeys,
+                          options.adjustValues,
+                          options.adjustTangentAngles,
+                          options.adjustTangentWeights,
+                          &animChange);
+}
 
 
-    // Set curve using parameters.
-    MTime::Unit unit = MTime::uiUnit();
-    const MAngle::Unit degUnit = MAngle::kDegrees;
-    for (i = 0; i < (m / 6); ++i) {
-        double t = p[(i * 6) + 0];  // time
-        double v = p[(i * 6) + 1];  // value
-        double it = p[(i * 6) + 2]; // in-tangent angle
-        double ot = p[(i * 6) + 3]; // out-tangent angle
-        double iw = p[(i * 6) + 4]; // in-tangent weight
-        double ow = p[(i * 6) + 5]; // out-tangent weight
-        MAngle ia(it, degUnit);
-        MAngle oa(ot, degUnit);
-
-        if (userData->adjustTimes) {
-            if (userData->forceWholeFrames){
-                t = double(int(t));
-            }
-            MTime time(t, unit);
-            userData->dstCurveFn->setTime((unsigned int) i, time, userData->animChange);
+inline
+bool solveCurveFit(MObject &srcCurve,
+                   MObject &dstCurve,
+                   MAnimCurveChange &animChange,
+                   const SolverOptions &options,
+                   double &outError,
+                   ErrorReport *outReport = NULL) {
+    MStatus status;
+    MFnAnimCurve srcCurveFn(srcCurve);
+    MFnAnimCurve dstCurveFn(dstCurve);
+
+    // Snapshot the curves, Maya is not touched while solving.
+    CurveKeys srcKeys;
+    CurveKeys dstKeys;
+    {
+        TRACE_SCOPE("snapshot");
+        status = readCurveKeys(srcCurveFn, srcKeys);
+        if (status != MS::kSuccess) {
+            return false;
         }
-        if (userData->adjustValues) {
-            userData->dstCurveFn->setValue((unsigned int) i, v, userData->animChange);
+        status = readCurveKeys(dstCurveFn, dstKeys);
+        if (status != MS::kSuccess) {
+            return false;
         }
-        if (userData->adjustTangentAngles) {
-            userData->dstCurveFn->setAngle((unsigned int) i, ia, true, userData->animChange);
-            userData->dstCurveFn->setAngle((unsigned int) i, oa, false, userData->animChange);
+    }
+
+    bool ret = solveCurveKeys(srcKeys, dstKeys, options, outError, outReport);
+    if (ret == false) {
+        return false;
+    }
+
+    status = applySolvedCurveKeys(dstCurve, dstKeys, options, false, animChange);
+    return status == MS::kSuccess;
+}
+
+
+// Reduce the source animCurve to the fewest keyframes matching it
+// within 'tolerance', and replace the destination keyframes with them.
+inline
+bool reduceCurveFit(MObject &srcCurve,
+                    MObject &dstCurve,
+                    MAnimCurveChange &animChange,
+                    const SolverOptions &options,
+                    double tolerance,
+                    double &outError,
+                    ErrorReport *outReport = NULL) {
+    MStatus status;
+    MFnAnimCurve srcCurveFn(srcCurve);
+
+    CurveKeys srcKeys;
+    {
+        TRACE_SCOPE("snapshot");
+        status = readCurveKeys(srcCurveFn, srcKeys);
+        if (status != MS::kSuccess) {
+            return false;
         }
-//        if (userData->adjustTangentWeights) {
-//            userData->dstCurveFn->setWeight((unsigned int) i, iw, true, userData->animChange);
-//            userData->dstCurveFn->setWeight((unsigned int) i, ow, false, userData->animChange);
-//        }
     }
 
-    unsigned int srcNumKeys = userData->srcCurveFn->numKeys();
-    unsigned int dstNumKeys = userData->dstCurveFn->numKeys();
-
-    MTime startTime = userData->srcCurveFn->time(0);
-    MTime endTime = userData->srcCurveFn->time(srcNumKeys - 1);
-    double start = startTime.asUnits(unit);
-    double end = endTime.asUnits(unit);
-    double framesDist = end - start;
-
-    // Calculate
-    MTime curTime = startTime;
-    for (i = 0; i < n; ++i) {
-        double srcValue = userData->srcCurveFn->evaluate(curTime);
-        double dstValue = userData->dstCurveFn->evaluate(curTime);
-        double diff = fabs(srcValue - dstValue);
-        x[i] = 0.5 * (diff * diff);
-        curTime += (double(n) / framesDist);
+    CurveKeys dstKeys;
+    bool ret = reduceAndSolveCurveKeys(srcKeys, dstKeys, options, tolerance, outError, outReport);
+    if (ret == false) {
+        return false;
     }
+
+    status = applySolvedCurveKeys(dstCurve, dstKeys, options, true, animChange);
+    return status == MS::kSuccess;
 }
 
 
+// Find the fewest keyframes (from 'minKeys' to 'maxKeys') matching the
+// source within 'tolerance', and replace the destination keyframes
+// with them. 'outError' is the maximum sample error.
 inline
-bool solveCurveFit(int iterMax,
-                   MObject &srcCurve,
+bool sweepCurveFit(const CurveSource &source,
                    MObject &dstCurve,
                    MAnimCurveChange &animChange,
-                   bool adjustValues,
-                   bool adjustTimes,
-                   bool adjustTangentAngles,
-                   bool adjustTangentWeights,
-                   bool scaleTimeKeys,
-                   bool forceWholeFrames,
-                   bool addKeys,
+                   const SolverOptions &options,
+                   unsigned int minKeys,
+                   unsigned int maxKeys,
+                   double tolerance,
                    double &outError) {
-    register int i, j;
-    int ret;
-
-    MFnAnimCurve *srcCurveFn = new MFnAnimCurve(srcCurve);
-    MFnAnimCurve *dstCurveFn = new MFnAnimCurve(dstCurve);
-    // TODO: Try adding new keys to reduce the error, if this is required. This would require a second loop
-    unsigned int srcNumKeys = srcCurveFn->numKeys();
-    unsigned int dstNumKeys = dstCurveFn->numKeys();
-    assert(srcNumKeys >= 2);
-    assert(dstNumKeys >= 2);
-
-    // Number of unknown parameters.
-    // For each keyframe, a time, value, in / out tangent angles and weights may be calculated.
-    const int m = dstNumKeys * 6;
-    double params[m];
-
-    // Number of measurement errors. (Must be less than unknown parameters).
-    // This is the number of integer frames between the
-    // start and end frames of the source curve
+    double framesPerSecond = MTime(1.0, MTime::kSeconds).asUnits(MTime::uiUnit());
+    CurveKeys dstKeys;
+    bool ret = sweepCurveKeys(source, minKeys, maxKeys, options, tolerance, framesPerSecond, dstKeys, outError);
+    if (ret == false) {
+        return false;
+    }
+
+    MStatus status = applySolvedCurveKeys(dstCurve, dstKeys, options, true, animChange);
+    return status == MS::kSuccess;
+}
+
+
+// Sample 'plugs' at every frame from 'startFrame' to 'endFrame'. Time
+// is the outer loop, so all plugs are evaluated in a single pass over
+// the frame range, sharing each frame's DG evaluation.
+inline
+MStatus bakePlugSamples(const MPlugArray &plugs,
+                        double startFrame,
+                        double endFrame,
+                        std::vector<CurveSamples> &samples) {
+    TRACE_SCOPE("bake");
+    MStatus status;
+    int numFrames = bakeFrameCount(startFrame, endFrame);
+    if (numFrames < 2) {
+        ERR("At least 2 frames must be baked.");
+        return MStatus::kFailure;
+    }
+
+    unsigned int numPlugs = plugs.length();
+    samples.resize(numPlugs);
+    for (unsigned int p = 0; p < numPlugs; ++p) {
+        samples[p].times.resize(numFrames);
+        samples[p].values.resize(numFrames);
+    }
+
     MTime::Unit unit = MTime::uiUnit();
-    unsigned int srcFirstKey = 0;
-    unsigned int srcLastKey = srcNumKeys - 1;
-    MTime startTime = srcCurveFn->time(srcFirstKey);
-    MTime endTime = srcCurveFn->time(srcLastKey);
-    double start = startTime.asUnits(unit);
-    double end = endTime.asUnits(unit);
-    int frames = int(end) - int(start);
-    if (frames < m) {
-        // Ensure the number of unknowns is equal or greater than number of errors.
-        frames = m;
+    for (int f = 0; f < numFrames; ++f) {
+        double frame = startFrame + double(f);
+        MDGContext context(MTime(frame, unit));
+        for (unsigned int p = 0; p < numPlugs; ++p) {
+            samples[p].times[f] = frame;
+            samples[p].values[f] = plugs[p].asDouble(context, &status);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+        }
     }
-    int n = frames;
-    INFO("m=" << m);
-    INFO("n=" << n);
-    assert(m <= n);
-
-    // Stretch out the curves to align to the source start/end key frames.
-    if (scaleTimeKeys) {
-        dstCurveFn->setPreInfinityType(MFnAnimCurve::kLinear);
-        dstCurveFn->setPostInfinityType(MFnAnimCurve::kLinear);
-        unsigned int dstFirstKey = 0;
-        unsigned int dstLastKey = dstNumKeys - 1;
-        MTime prevStart = dstCurveFn->time(dstFirstKey);
-        MTime prevEnd = dstCurveFn->time(dstLastKey);
-
-        // Change times.
-        MTimeArray times;
-        times.append(startTime);
-        MTime midTime;
-        MTime prevMid;
-        for (unsigned int k=1; k<(dstNumKeys-1); ++k) {
-            prevMid = dstCurveFn->time(k);
-
-            // TODO: The 'mid' values are still a little wrong.
-            double newDist = endTime.asUnits(unit) - startTime.asUnits(unit);
-            double prevDist = prevEnd.asUnits(unit) - prevStart.asUnits(unit);
-            double prevMidRatio = (prevMid.asUnits(unit) - prevStart.asUnits(unit)) / prevEnd.asUnits(unit);
-            double mid = ((startTime.asUnits(unit) * prevMidRatio) +
-                    ((prevEnd.asUnits(unit) * ((newDist + 1.0) / prevDist)) * prevMidRatio));
-
-            if (forceWholeFrames) {
-                midTime = MTime(double(int(mid)), unit);
-            } else {
-                midTime = MTime(mid, unit);
-            }
+    return status;
+}
 
-            times.append(midTime);
+
+// Bake 'plugs' like 'bakePlugSamples', using the disk cache in
+// 'cacheDir' (no cache when empty). Only plugs missing from the cache
+// are evaluated; 'outNumBaked' is set to their number.
+inline
+MStatus bakeCachedPlugs(const MPlugArray &plugs,
+                        double startFrame,
+                        double endFrame,
+                        const MString &cacheDir,
+                        std::vector<CurveSamples> &samples,
+                        unsigned int &outNumBaked) {
+    MStatus status;
+    unsigned int numPlugs = plugs.length();
+    samples.resize(numPlugs);
+
+    // Samples depend on the scene and the time unit, not just the plug.
+    BakeCacheKey baseKey;
+    baseKey.sceneFile = MFileIO::currentFile().asChar();
+    baseKey.startFrame = startFrame;
+    baseKey.endFrame = endFrame;
+    baseKey.framesPerSecond = MTime(1.0, MTime::kSeconds).asUnits(MTime::uiUnit());
+
+    std::vector<BakeCacheKey> keys(numPlugs, baseKey);
+    std::vector<std::string> paths(numPlugs);
+    std::vector<unsigned int> missing;
+    MPlugArray missingPlugs;
+    {
+        TRACE_SCOPE("readBakeCache");
+        for (unsigned int p = 0; p < numPlugs; ++p) {
+            keys[p].plugName = plugs[p].name().asChar();
+            if (cacheDir.length() > 0) {
+                paths[p] = bakeCachePath(cacheDir.asChar(), keys[p]);
+                if (readBakeCache(paths[p], keys[p], samples[p])) {
+                    continue;
+                }
+            }
+            missing.push_back(p);
+            missingPlugs.append(plugs[p]);
         }
-        times.append(endTime);
+    }
+    outNumBaked = (unsigned int) missing.size();
+    if (missing.empty()) {
+        return status;
+    }
 
-        // Set Keyframes in reverse, so we don't break the indexes.
-        for (int k=times.length()-1; k>=0; --k) {
-            dstCurveFn->setTime((unsigned int) k, times[k]);
+    std::vector<CurveSamples> baked;
+    status = bakePlugSamples(missingPlugs, startFrame, endFrame, baked);
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+    for (size_t i = 0; i < missing.size(); ++i) {
+        unsigned int p = missing[i];
+        samples[p] = baked[i];
+        if (cacheDir.length() > 0) {
+            if (!writeBakeCache(paths[p], keys[p], samples[p])) {
+                WRN("animCurveMatch: Could not write bake cache file: " << paths[p]);
+            }
         }
     }
+    return status;
+}
 
-    // Standard Lev-Mar arguments.
-    double opts[LM_OPTS_SZ];
-    double info[LM_INFO_SZ];
-
-    // Options
-    // NOTE: Init and diff delta values are large enough to move the frame by one value.
-    opts[0] = LM_INIT_MU * 10000000.0; //  * 100.0;
-    opts[1] = 1E-15;
-    opts[2] = 1E-15;
-    opts[3] = 1E-20;
-    opts[4] = -LM_DIFF_DELTA * 1000000.0; //  * 10.0;
-
-    struct CurveData userData;
-    userData.srcCurveFn = srcCurveFn;
-    userData.dstCurveFn = dstCurveFn;
-    userData.animChange = &animChange;
-    userData.adjustValues = adjustValues;
-    userData.adjustTimes = adjustTimes;
-    userData.adjustTangentAngles = adjustTangentAngles;
-    userData.adjustTangentWeights = adjustTangentWeights;
-    userData.forceWholeFrames = forceWholeFrames;
-    userData.addKeys = addKeys;
-
-//    // Ensure we can unlock weights if we will calculate the weights
-//    if (adjustTangentWeights)
-//    {
-//        dstCurveFn->setIsWeighted(true);
-//    }
-
-    // Set Initial parameters
-    for (i = 0; i < (m / 6); ++i) {
-        // Get time
-        double t = 0.0;
-//        if (dstCurveFn->isTimeInput()) {
-        MTime time = dstCurveFn->time((unsigned int) i);
-        t = time.asUnits(MTime::uiUnit());
-//        INFO("t=" << t);
-//        } else{
-//            t = dstCurveFn->unitlessInput((unsigned int) i);
-//        }
-
-        // Value
-        double v = dstCurveFn->value((unsigned int) i);
-
-//        // Ensure weights are unlocked if we will calculate the weights
-//        if (adjustTangentWeights)
-//        {
-//            dstCurveFn->setWeightsLocked(0, false);
-//        }
 
-        // Tangents angle and weights
-        MAngle ia = 0;
-        MAngle oa = 0;
-        double iw = 1.0;
-        double ow = 1.0;
-        dstCurveFn->getTangent((unsigned int) i, ia, iw, true);
-        dstCurveFn->getTangent((unsigned int) i, oa, ow, true);
-
-        // Set into data structure.
-        params[(i * 6) + 0] = t; // time
-        params[(i * 6) + 1] = v; // value
-        params[(i * 6) + 2] = ia.asDegrees(); // in-tangent angle
-        params[(i * 6) + 3] = oa.asDegrees(); // out-tangent angle
-        params[(i * 6) + 4] = iw; // in-tangent weight
-        params[(i * 6) + 5] = ow; // out-tangent weight
+// Solve the destination animCurve to match baked samples.
+inline
+bool solveSampledCurveFit(const CurveSamples &srcSamples,
+                          MObject &dstCurve,
+                          MAnimCurveChange &animChange,
+                          const SolverOptions &options,
+                          double &outError,
+                          ErrorReport *outReport = NULL) {
+    MStatus status;
+    MFnAnimCurve dstCurveFn(dstCurve);
+
+    CurveKeys dstKeys;
+    {
+        TRACE_SCOPE("snapshot");
+        status = readCurveKeys(dstCurveFn, dstKeys);
+        if (status != MS::kSuccess) {
+            return false;
+        }
     }
 
-    // Initial Parameters
-    INFO("Initial Parameters: ");
-    for (i = 0; i < m; ++i) {
-        INFO("-> " << params[i]);
-    }
-    INFO("");
-
-    // Allocate a memory block for both 'work' and 'covar', so that
-    // the block is close together in physical memory.
-    double *work, *covar;
-    work = (double *) malloc((LM_DIF_WORKSZ(m, n) + m * m) * sizeof(double));
-    if (!work) {
-        ERR("Memory allocation request failed.");
-        delete srcCurveFn;
-        delete dstCurveFn;
+    bool ret = solveCurveSamples(srcSamples, dstKeys, options, outError, outReport);
+    if (ret == false) {
         return false;
     }
-    covar = work + LM_DIF_WORKSZ(m, n);
-
-    // no Jacobian, caller allocates work memory, covariance estimated
-    ret = dlevmar_dif(
-
-            // Function to call (input only)
-            // Function must be of the structure:
-            //   func(double *params, double *x, int m, int n, void *data)
-            curveFunc,
-
-            // Parameters (input and output)
-            // Should be filled with initial estimate, will be filled
-            // with output parameters
-            params,
-
-            // Measurement Vector (input only)
-            // NULL implies a zero vector
-            NULL,
-
-            // Parameter Vector Dimension (input only)
-            // (i.e. #unknowns)
-            m,
-
-            // Measurement Vector Dimension (input only)
-            n,
-
-            // Maximum Number of Iterations (input only)
-            iterMax,
-
-            // Minimisation options (input only)
-            // opts[0] = tau      (scale factor for initialTransform mu)
-            // opts[1] = epsilon1 (stopping threshold for ||J^T e||_inf)
-            // opts[2] = epsilon2 (stopping threshold for ||Dp||_2)
-            // opts[3] = epsilon3 (stopping threshold for ||e||_2)
-            // opts[4] = delta    (step used in difference approximation to the Jacobian)
-            //
-            // If \delta<0, the Jacobian is approximated with central differences
-            // which are more accurate (but slower!) compared to the forward
-            // differences employed by default.
-            // Set to NULL for defaults to be used.
-            opts,
-
-            // Output Information (output only)
-            // information regarding the minimization.
-            // info[0] = ||e||_2 at initialTransform params.
-            // info[1-4] = (all computed at estimated params)
-            //  [
-            //   ||e||_2,
-            //   ||J^T e||_inf,
-            //   ||Dp||_2,
-            //   \mu/max[J^T J]_ii
-            //  ]
-            // info[5] = number of iterations,
-            // info[6] = reason for terminating:
-            //   1 - stopped by small gradient J^T e
-            //   2 - stopped by small Dp
-            //   3 - stopped by iterMax
-            //   4 - singular matrix. Restart from current params with increased \mu
-            //   5 - no further error reduction is possible. Restart with increased mu
-            //   6 - stopped by small ||e||_2
-            //   7 - stopped by invalid (i.e. NaN or Inf) "func" refPoints; a user error
-            // info[7] = number of function evaluations
-            // info[8] = number of Jacobian evaluations
-            // info[9] = number linear systems solved (number of attempts for reducing error)
-            //
-            // Set to NULL if don't care
-            info,
-
-            // Working Data (input only)
-            // working memory, allocated internally if NULL. If !=NULL, it is assumed to
-            // point to a memory chunk at least LM_DIF_WORKSZ(m, n)*sizeof(double) bytes
-            // long
-            work,
-
-            // Covariance matrix (output only)
-            // Covariance matrix corresponding to LS solution; Assumed to point to a mxm matrix.
-            // Set to NULL if not needed.
-            covar,
-
-            // Custom Data for 'func' (input only)
-            // pointer to possibly needed additional data, passed uninterpreted to func.
-            // Set to NULL if not needed
-            (void *) &userData);
-
-//    INFO("Covariance of the fit:");
-//    for (i = 0; i < m; ++i) {
-//        for (j = 0; j < m; ++j) {
-//            INFO(covar[i * m + j]);
-//        }
-//        INFO("");
-//    }
-//    INFO("");
-
-    free(work);
-
-    INFO("Results:");
-    INFO("Levenberg-Marquardt returned " << ret << " in " << (int) info[5]
-                                         << " iterations");
-
-    int reasonNum = (int) info[6];
-    INFO("Reason: " << reasons[reasonNum]);
-    INFO("Reason number: " << info[6]);
-    INFO("");
-
-    INFO("Solved Parameters:");
-    for (i = 0; i < m; ++i) {
-        INFO("-> " << params[i]);
-    }
-    INFO("");
 
-    INFO(std::endl << std::endl << "Solve Information:");
-    INFO("Initial Error: " << info[0]);
+    status = applySolvedCurveKeys(dstCurve, dstKeys, options, false, animChange);
+    return status == MS::kSuccess;
+}
+
 
-    INFO("Overall Error: " << info[1]);
-    INFO("J^T Error: " << info[2]);
-    INFO("Dp Error: " << info[3]);
-    INFO("Max Error: " << info[4]);
+// Flatten an error report for the command result:
+// [error, numSamples, numSegments, sample times..., sample errors...,
+//  segment maximum errors..., segment RMS errors...]
+inline
+void errorReportToArray(const ErrorReport &report, MDoubleArray &array) {
+    unsigned int numSamples = (unsigned int) report.sampleErrors.size();
+    unsigned int numSegments = (unsigned int) report.segmentMaxErrors.size();
+    array.setLength(3 + (numSamples * 2) + (numSegments * 2));
+    unsigned int j = 0;
+    array[j++] = report.error;
+    array[j++] = double(numSamples);
+    array[j++] = double(numSegments);
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        array[j++] = report.sampleTimes[i];
+    }
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        array[j++] = report.sampleErrors[i];
+    }
+    for (unsigned int i = 0; i < numSegments; ++i) {
+        array[j++] = report.segmentMaxErrors[i];
+    }
+    for (unsigned int i = 0; i < numSegments; ++i) {
+        array[j++] = report.segmentRmsErrors[i];
+    }
+}
 
-    INFO("Iterations: " << info[5]);
-    INFO("Termination Reason: " << reasons[reasonNum]);
-    INFO("Function Evaluations: " << info[7]);
-    INFO("Jacobian Evaluations: " << info[8]);
-    INFO("Attempts for reducing error: " << info[9]);
 
-    outError = info[1];
+// Append the keyframe covariance of an error report to the command
+// result: [numKeys, covariance blocks...], each block kParamsPerKey x
+// kParamsPerKey values (row-major).
+inline
+void keyCovarianceToArray(const ErrorReport &report, MDoubleArray &array) {
+    unsigned int blockSize = kParamsPerKey * kParamsPerKey;
+    unsigned int numKeys = (unsigned int) (report.keyCovariance.size() / blockSize);
+    unsigned int j = array.length();
+    array.setLength(j + 1 + (numKeys * blockSize));
+    array[j++] = double(numKeys);
+    for (unsigned int i = 0; i < (numKeys * blockSize); ++i) {
+        array[j++] = report.keyCovariance[i];
+    }
+}
 
-    delete srcCurveFn;
-    delete dstCurveFn;
 
-    return ret != -1;
+// Flatten solved keyframes for the command result:
+// [error, numKeys, times..., values..., in-tangent angles...,
+//  out-tangent angles..., in-tangent weights..., out-tangent weights...]
+inline
+void curveKeysToArray(double error, const CurveKeys &keys, MDoubleArray &array) {
+    unsigned int numKeys = keys.numKeys();
+    array.setLength(2 + (numKeys * kParamsPerKey));
+    unsigned int j = 0;
+    array[j++] = error;
+    array[j++] = double(numKeys);
+    const std::vector<double> *attrs[kParamsPerKey] = {
+            &keys.times,
+            &keys.values,
+            &keys.inAngles,
+            &keys.outAngles,
+            &keys.inWeights,
+            &keys.outWeights,
+    };
+    for (int a = 0; a < kParamsPerKey; ++a) {
+        for (unsigned int i = 0; i < numKeys; ++i) {
+            array[j++] = (*attrs[a])[i];
+        }
+    }
 }
 
 
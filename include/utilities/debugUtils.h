@@ -9,6 +9,11 @@
 #include <iostream> // cout, cerr, endl
 #include <iomanip>  // setfill, setw
 #include <string>   // string
+#include <atomic>   // atomic
+#include <mutex>    // mutex, lock_guard
+#include <memory>   // shared_ptr
+#include <vector>   // vector
+#include <fstream>  // ofstream
 
 // Linux Specific Functions
 #include <sys/time.h>  // gettimeofday
@@ -26,9 +31,77 @@
 #define WRN(x) do { std::cerr << "WARNING: " << x << std::endl; } while (0)
 #define INFO(x) do { std::cout << x << std::endl; } while (0)
 
+// Leveled logging.
+//
+// The level check happens before anything is streamed, so a disabled
+// level costs a single integer compare. Levels above
+// DEBUG_LOG_MAX_LEVEL are removed at compile time.
+#ifndef DEBUG_LOG_MAX_LEVEL
+#define DEBUG_LOG_MAX_LEVEL 2
+#endif
+
+#define LOG(level, x) do { if (((level) <= DEBUG_LOG_MAX_LEVEL) && debug::isLogEnabled(level)) { std::cout << x << std::endl; } } while (0)
+#define LOG_INFO(x) LOG(debug::kLogInfo, x)
+#define LOG_DEBUG(x) LOG(debug::kLogDebug, x)
+
+// Trace spans, recorded only while tracing is enabled.
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) debug::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
 
 namespace debug
 {
+  // Verbosity levels, errors and warnings are always printed.
+  enum LogLevel
+  {
+    kLogQuiet = 0,
+    kLogInfo = 1,
+    kLogDebug = 2
+  };
+
+  // Maximum number of values printed by a single parameter dump.
+  const int kLogMaxValues = 36;
+
+  inline
+  std::atomic<int> &logLevel()
+  {
+    static std::atomic<int> level(kLogQuiet);
+    return level;
+  }
+
+  inline
+  void setLogLevel(int level)
+  {
+    logLevel().store(level, std::memory_order_relaxed);
+  }
+
+  inline
+  bool isLogEnabled(int level)
+  {
+    return level <= logLevel().load(std::memory_order_relaxed);
+  }
+
+  // Print up to 'kLogMaxValues' values, only when debug logging is on.
+  inline
+  void logValues(const char *heading, const double *values, int num)
+  {
+    if (!isLogEnabled(kLogDebug))
+    {
+      return;
+    }
+    std::cout << heading << std::endl;
+    int count = num < kLogMaxValues ? num : kLogMaxValues;
+    for (int i = 0; i < count; ++i)
+    {
+      std::cout << "-> " << values[i] << std::endl;
+    }
+    if (count < num)
+    {
+      std::cout << "-> ... (" << (num - count) << " more)" << std::endl;
+    }
+  }
+
   typedef unsigned int uint32;
   typedef unsigned long long uint64;
   typedef unsigned long long Ticks;
@@ -153,6 +226,257 @@ uint64_t rdtsc(){
   };
 
 
+  // Chrome trace-event recording.
+  //
+  // Each thread records into its own fixed size buffer, without
+  // locking. The mutex is only taken when a thread first records
+  // (to claim a buffer) and when the trace is written. A buffer is
+  // released when its thread exits, so worker threads started for
+  // every solve re-use buffers rather than allocating new ones.
+  //
+  // Event names must be string literals.
+
+  // Maximum number of events recorded per thread, later events are dropped.
+  const size_t kTraceBufferEvents = 1 << 16;
+
+  struct TraceEvent
+  {
+    const char *name;
+    Timestamp start;
+    Timestamp duration;
+    const char *argName;
+    double argValue;
+  };
+
+  struct TraceBuffer
+  {
+    TraceBuffer(int id) :
+        id(id),
+        generation(0),
+        inUse(false),
+        count(0),
+        dropped(0),
+        events(new TraceEvent[kTraceBufferEvents])
+    {}
+
+    int id;
+    std::atomic<unsigned int> generation;
+    bool inUse;
+    std::atomic<size_t> count;
+    size_t dropped;
+    std::unique_ptr<TraceEvent[]> events;
+  };
+
+  struct TraceState
+  {
+    TraceState() :
+        enabled(false),
+        generation(0)
+    {}
+
+    std::atomic<bool> enabled;
+    std::atomic<unsigned int> generation;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceBuffer> > buffers;
+  };
+
+  inline
+  TraceState &traceState()
+  {
+    static TraceState state;
+    return state;
+  }
+
+  inline
+  bool isTraceEnabled()
+  {
+    return traceState().enabled.load(std::memory_order_relaxed);
+  }
+
+  // Claims a trace buffer for the current thread, and releases it again
+  // when the thread exits.
+  class TraceBufferHandle
+  {
+  public:
+    TraceBufferHandle() {}
+
+    ~TraceBufferHandle()
+    {
+      if (buffer)
+      {
+        TraceState &state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        buffer->inUse = false;
+      }
+    }
+
+    TraceBuffer &get()
+    {
+      if (!buffer)
+      {
+        TraceState &state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (size_t i = 0; i < state.buffers.size(); ++i)
+        {
+          if (!state.buffers[i]->inUse)
+          {
+            buffer = state.buffers[i];
+            break;
+          }
+        }
+        if (!buffer)
+        {
+          buffer.reset(new TraceBuffer((int) state.buffers.size() + 1));
+          state.buffers.push_back(buffer);
+        }
+        buffer->inUse = true;
+      }
+      return *buffer;
+    }
+
+  private:
+    std::shared_ptr<TraceBuffer> buffer;
+  };
+
+  inline
+  void recordTrace(const char *name,
+                   Timestamp start,
+                   Timestamp duration,
+                   const char *argName = NULL,
+                   double argValue = 0.0)
+  {
+    static thread_local TraceBufferHandle handle;
+    TraceBuffer &buffer = handle.get();
+
+    // Events from an earlier trace are discarded.
+    unsigned int generation = traceState().generation.load(std::memory_order_acquire);
+    size_t index = buffer.count.load(std::memory_order_relaxed);
+    if (buffer.generation.load(std::memory_order_relaxed) != generation)
+    {
+      buffer.count.store(0, std::memory_order_relaxed);
+      buffer.generation.store(generation, std::memory_order_release);
+      buffer.dropped = 0;
+      index = 0;
+    }
+    if (index >= kTraceBufferEvents)
+    {
+      ++buffer.dropped;
+      return;
+    }
+    TraceEvent &event = buffer.events[index];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.argName = argName;
+    event.argValue = argValue;
+    buffer.count.store(index + 1, std::memory_order_release);
+  }
+
+  // Start recording a new trace, events of any previous trace are discarded.
+  inline
+  void beginTrace()
+  {
+    TraceState &state = traceState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.generation.fetch_add(1, std::memory_order_acq_rel);
+    state.enabled.store(true, std::memory_order_relaxed);
+  }
+
+  // Stop recording and write all events as Chrome trace-event JSON
+  // (load the file in chrome://tracing or https://ui.perfetto.dev).
+  // Threads should have finished recording before the trace is written.
+  inline
+  bool endTrace(const std::string &filePath)
+  {
+    TraceState &state = traceState();
+    state.enabled.store(false, std::memory_order_relaxed);
+
+    std::ofstream file(filePath.c_str());
+    if (!file.is_open())
+    {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    unsigned int generation = state.generation.load(std::memory_order_acquire);
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for (size_t i = 0; i < state.buffers.size(); ++i)
+    {
+      const TraceBuffer &buffer = *state.buffers[i];
+      if (buffer.generation.load(std::memory_order_acquire) != generation)
+      {
+        continue;
+      }
+      size_t count = buffer.count.load(std::memory_order_acquire);
+      for (size_t j = 0; j < count; ++j)
+      {
+        const TraceEvent &event = buffer.events[j];
+        file << (first ? "\n" : ",\n");
+        file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1"
+             << ",\"tid\":" << buffer.id
+             << ",\"ts\":" << event.start
+             << ",\"dur\":" << event.duration;
+        if (event.argName)
+        {
+          file << ",\"args\":{\"" << event.argName << "\":" << event.argValue << "}";
+        }
+        file << "}";
+        first = false;
+      }
+      if (buffer.dropped > 0)
+      {
+        std::cerr << "WARNING: Trace buffer full, dropped " << buffer.dropped << " events." << std::endl;
+      }
+    }
+    file << "\n]}\n";
+    return true;
+  }
+
+  // Records a span from construction to destruction, when tracing is enabled.
+  class TraceScope
+  {
+  public:
+    TraceScope(const char *name) :
+        name(name),
+        start(0),
+        argName(NULL),
+        argValue(0.0)
+    {
+      if (isTraceEnabled())
+      {
+        start = get_timestamp();
+      }
+    }
+
+    ~TraceScope()
+    {
+      if (start != 0)
+      {
+        recordTrace(name, start, get_timestamp() - start, argName, argValue);
+      }
+    }
+
+    // Attach a single number to the span, shown as an 'args' entry.
+    void setArg(const char *key, double value)
+    {
+      argName = key;
+      argValue = value;
+    }
+
+    // Rename the span, for spans only classified once the work is done.
+    void setName(const char *value)
+    {
+      name = value;
+    }
+
+  private:
+    const char *name;
+    Timestamp start;
+    const char *argName;
+    double argValue;
+  };
+
+
 //  inline
 //  void printLine(std::ostream stream, std::string c = "-", int num = 80)
 //  {
@@ -0,0 +1,183 @@
+/*
+ * Stand-alone batch solver for job manifests, without Maya.
+ *
+ *   animCurveMatchBatch [-workers N] [-verbosity N] <manifest> <results>
+ *
+ * The manifest's jobs are split across N worker processes (one per
+ * core by default), each writing its results to a shard file next to
+ * <results>. A worker that crashes only loses its unfinished jobs.
+ * Once all workers have exited the shards are merged, in manifest
+ * order, into <results>, which is applied in Maya with
+ * 'animCurveMatch -importResults <results>'.
+ *
+ * Exits with 0 when every job was solved, otherwise 1.
+ */
+
+
+//
+#include <animCurveMatchManifest.h>
+
+// STL
+#include <cstdio>     // remove
+#include <cstdlib>    // atoi
+#include <cstring>    // strcmp
+#include <string>     // string
+#include <vector>     // vector
+#include <fstream>    // ifstream, ofstream
+#include <sstream>    // ostringstream
+#include <iomanip>    // setprecision
+#include <thread>     // hardware_concurrency
+#include <algorithm>  // min, max, sort
+
+// POSIX
+#include <unistd.h>    // fork, _exit
+#include <sys/wait.h>  // waitpid
+
+// Utils
+#include <utilities/debugUtils.h>
+
+
+namespace {
+
+    void printUsage() {
+        ERR("Usage: animCurveMatchBatch [-workers N] [-verbosity N] <manifest> <results>");
+    }
+
+
+    std::string shardPath(const std::string &resultsPath, int shard) {
+        std::ostringstream path;
+        path << resultsPath << ".shard" << shard;
+        return path.str();
+    }
+
+
+    // Worker process, solves every 'numShards'-th job starting at
+    // 'shard'. Each result is flushed as soon as it is solved, so a
+    // crash keeps the finished results.
+    int runShard(const std::vector<CurveJob> &jobs,
+                 int shard,
+                 int numShards,
+                 const std::string &path) {
+        std::ofstream file(path.c_str(), std::ios::trunc);
+        if (!file) {
+            ERR("Could not write shard: " << path);
+            return 1;
+        }
+        file << std::setprecision(kManifestPrecision);
+        file << kResultsMagic << " " << kManifestVersion << std::endl;
+
+        int numFailed = 0;
+        for (size_t i = shard; i < jobs.size(); i += numShards) {
+            CurveJob job = jobs[i];
+            bool ret = solveCurveJob(job);
+            if (!ret) {
+                WRN("Job " << i << " (" << job.dstCurveName << ") was not solved.");
+                numFailed += 1;
+            }
+            LOG_INFO("Job " << i << " (" << job.dstCurveName << ") error: " << job.error);
+            writeJobResult(file, (unsigned int) i, ret, job);
+            file.flush();
+        }
+        return (file && (numFailed == 0)) ? 0 : 1;
+    }
+
+
+    bool compareResultIndex(const JobResult &a, const JobResult &b) {
+        return a.index < b.index;
+    }
+
+}
+
+
+int main(int argc, char **argv) {
+    int numWorkers = (int) std::thread::hardware_concurrency();
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-workers") == 0) && ((i + 1) < argc)) {
+            numWorkers = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-verbosity") == 0) && ((i + 1) < argc)) {
+            debug::setLogLevel(atoi(argv[++i]));
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2) {
+        printUsage();
+        return 1;
+    }
+    const std::string &manifestPath = paths[0];
+    const std::string &resultsPath = paths[1];
+
+    std::vector<CurveJob> jobs;
+    if (!readManifest(manifestPath, jobs)) {
+        ERR("Could not read manifest: " << manifestPath);
+        return 1;
+    }
+    int numJobs = (int) jobs.size();
+    numWorkers = std::max(1, std::min(numWorkers, numJobs));
+    LOG_INFO("Solving " << numJobs << " jobs with " << numWorkers << " workers.");
+
+    // Share the cores between the workers, so restarts and sweeps do
+    // not start a thread per core in every worker.
+    int numCores = std::max((int) std::thread::hardware_concurrency(), 1);
+    int maxThreads = std::max(numCores / numWorkers, 1);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        jobs[i].options.maxThreads = maxThreads;
+    }
+
+    // Fork the workers before any thread is started.
+    std::vector<pid_t> workers(numWorkers, -1);
+    for (int s = 0; s < numWorkers; ++s) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(runShard(jobs, s, numWorkers, shardPath(resultsPath, s)));
+        } else if (pid < 0) {
+            ERR("Could not start worker " << s << ".");
+        }
+        workers[s] = pid;
+    }
+
+    bool ok = true;
+    for (int s = 0; s < numWorkers; ++s) {
+        if (workers[s] < 0) {
+            ok = false;
+            continue;
+        }
+        int status = 0;
+        waitpid(workers[s], &status, 0);
+        if (WIFSIGNALED(status)) {
+            WRN("Worker " << s << " crashed (signal " << WTERMSIG(status) << "), its unfinished jobs are lost.");
+            ok = false;
+        } else if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            ok = false;
+        }
+    }
+
+    // Merge the shards. A shard cut short by a crash is read up to its
+    // last complete result.
+    std::vector<JobResult> results;
+    for (int s = 0; s < numWorkers; ++s) {
+        std::string path = shardPath(resultsPath, s);
+        std::ifstream file(path.c_str());
+        if (!file || !readManifestHeader(file, kResultsMagic)) {
+            continue;
+        }
+        if (!readJobResults(file, results)) {
+            WRN("Shard " << s << " ends with an incomplete result.");
+        }
+        file.close();
+        std::remove(path.c_str());
+    }
+    std::sort(results.begin(), results.end(), compareResultIndex);
+    if ((int) results.size() < numJobs) {
+        WRN((numJobs - (int) results.size()) << " of " << numJobs << " jobs have no result.");
+        ok = false;
+    }
+
+    if (!writeResultsFile(resultsPath, results)) {
+        ERR("Could not write results: " << resultsPath);
+        return 1;
+    }
+    LOG_INFO("Wrote " << results.size() << " results to " << resultsPath);
+    return ok ? 0 : 1;
+}
@@ -8,9 +8,17 @@
 //
 #include <animCurveMatchCmd.h>
 #include <animCurveMatchUtils.h>
+#include <animCurveMatchJobs.h>
 
 // STL
 #include <cmath>
+#include <vector>
+#include <algorithm>
+
+// Maya
+#include <maya/MAnimControl.h>
+#include <maya/MPlug.h>
+#include <maya/MPlugArray.h>
 
 // Utils
 #include <utilities/debugUtils.h>
@@ -30,7 +38,7 @@ bool animCurveMatchCmd::hasSyntax() const {
 }
 
 bool animCurveMatchCmd::isUndoable() const {
-    return true;
+    return m_isUndoable;
 }
 
 
@@ -45,8 +53,7 @@ MSyntax animCurveMatchCmd::newSyntax() {
     // Objects to work on.
     syntax.useSelectionAsDefault(false);
     syntax.setObjectType(MSyntax::kSelectionList);
-    syntax.setMinObjects(2);
-    syntax.setMaxObjects(2);
+    syntax.setMinObjects(0);
 
     // Flags
     syntax.addFlag(kNameFlag, kNameFlagLong, MSyntax::kString);
@@ -59,6 +66,37 @@ MSyntax animCurveMatchCmd::newSyntax() {
     syntax.addFlag(kForceWholeFramesFlag, kForceWholeFramesFlagLong, MSyntax::kBoolean);
     syntax.addFlag(kAddKeysFlag, kAddKeysFlagLong, MSyntax::kBoolean);
     syntax.addFlag(kNewCurveFlag, kNewCurveFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kReduceFlag, kReduceFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kToleranceFlag, kToleranceFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kSweepFlag, kSweepFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kMinKeysFlag, kMinKeysFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kMaxKeysFlag, kMaxKeysFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kRestartsFlag, kRestartsFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kDirectSolveFlag, kDirectSolveFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kPolishIterationsFlag, kPolishIterationsFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kStreamedFlag, kStreamedFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kTimeBudgetFlag, kTimeBudgetFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kTargetRmsErrorFlag, kTargetRmsErrorFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kTargetMaxErrorFlag, kTargetMaxErrorFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kErrorReportFlag, kErrorReportFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kCovarianceFlag, kCovarianceFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kBakeOnlyFlag, kBakeOnlyFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kStartFrameFlag, kStartFrameFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kEndFrameFlag, kEndFrameFlagLong, MSyntax::kDouble);
+    syntax.addFlag(kCacheDirFlag, kCacheDirFlagLong, MSyntax::kString);
+    syntax.addFlag(kIncrementalFlag, kIncrementalFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kChangedKeysFlag, kChangedKeysFlagLong, MSyntax::kUnsigned);
+    syntax.makeFlagMultiUse(kChangedKeysFlag);
+    syntax.addFlag(kNeighbourhoodFlag, kNeighbourhoodFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kAsyncFlag, kAsyncFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kDryRunFlag, kDryRunFlagLong, MSyntax::kBoolean);
+    syntax.addFlag(kExportJobFlag, kExportJobFlagLong, MSyntax::kString);
+    syntax.addFlag(kImportResultsFlag, kImportResultsFlagLong, MSyntax::kString);
+    syntax.addFlag(kJobStatusFlag, kJobStatusFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kCancelJobFlag, kCancelJobFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kApplyJobFlag, kApplyJobFlagLong, MSyntax::kUnsigned);
+    syntax.addFlag(kTraceFileFlag, kTraceFileFlagLong, MSyntax::kString);
+    syntax.addFlag(kVerbosityFlag, kVerbosityFlagLong, MSyntax::kUnsigned);
     return syntax;
 }
 
@@ -71,103 +109,390 @@ MStatus animCurveMatchCmd::parseArgs(const MArgList &args) {
     MArgDatabase argData(syntax(), args, &status);
     CHECK_MSTATUS_AND_RETURN_IT(status);
 
+    // Get 'Verbosity', first so the remaining flags are logged at the
+    // requested level. The level is shared by all solves (including
+    // running background jobs), so it only changes when given.
+    m_verbosity = kVerbosityDefaultValue;
+    if (argData.isFlagSet(kVerbosityFlag)) {
+        status = argData.getFlagArgument(kVerbosityFlag, 0, m_verbosity);
+        debug::setLogLevel((int) m_verbosity);
+    }
+
+    // Get 'Trace File'
+    m_traceFile = "";
+    if (argData.isFlagSet(kTraceFileFlag)) {
+        status = argData.getFlagArgument(kTraceFileFlag, 0, m_traceFile);
+    }
+    LOG_DEBUG("m_traceFile=" << m_traceFile);
+
+    // Get job sub-commands, these do not use any animCurves.
+    m_jobStatus = argData.isFlagSet(kJobStatusFlag);
+    m_cancelJob = argData.isFlagSet(kCancelJobFlag);
+    m_applyJob = argData.isFlagSet(kApplyJobFlag);
+    m_jobId = 0;
+    if (m_jobStatus) {
+        status = argData.getFlagArgument(kJobStatusFlag, 0, m_jobId);
+        return status;
+    } else if (m_cancelJob) {
+        status = argData.getFlagArgument(kCancelJobFlag, 0, m_jobId);
+        return status;
+    } else if (m_applyJob) {
+        status = argData.getFlagArgument(kApplyJobFlag, 0, m_jobId);
+        return status;
+    }
+
+    // Get 'Import Results', applies solved batch results to the
+    // animCurves named in the results file.
+    m_importResults = "";
+    if (argData.isFlagSet(kImportResultsFlag)) {
+        status = argData.getFlagArgument(kImportResultsFlag, 0, m_importResults);
+        LOG_DEBUG("m_importResults=" << m_importResults);
+        return status;
+    }
+
+    // Traces are recorded into global buffers, that a running job may
+    // be recording into too.
+    if ((m_traceFile.length() > 0) && isSolveJobRunning(false)) {
+        MGlobal::displayWarning("animCurveMatch: Cannot trace while a background job is running.");
+        return MStatus::kFailure;
+    }
+
+    // Get 'Start Frame' and 'End Frame', used when baking attributes.
+    // Defaults to the playback range.
+    m_startFrame = MAnimControl::minTime().asUnits(MTime::uiUnit());
+    if (argData.isFlagSet(kStartFrameFlag)) {
+        status = argData.getFlagArgument(kStartFrameFlag, 0, m_startFrame);
+    }
+    LOG_DEBUG("m_startFrame=" << m_startFrame);
+    m_endFrame = MAnimControl::maxTime().asUnits(MTime::uiUnit());
+    if (argData.isFlagSet(kEndFrameFlag)) {
+        status = argData.getFlagArgument(kEndFrameFlag, 0, m_endFrame);
+    }
+    LOG_DEBUG("m_endFrame=" << m_endFrame);
+
+    // Get 'Cache Dir'
+    m_cacheDir = "";
+    if (argData.isFlagSet(kCacheDirFlag)) {
+        status = argData.getFlagArgument(kCacheDirFlag, 0, m_cacheDir);
+    }
+    LOG_DEBUG("m_cacheDir=" << m_cacheDir);
+
     // Get nodes
     MSelectionList selList;
     status = argData.getObjects(selList);
     CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // Get 'Bake Only', all objects are attributes to bake.
+    m_bakeOnly = kBakeOnlyDefaultValue;
+    if (argData.isFlagSet(kBakeOnlyFlag)) {
+        status = argData.getFlagArgument(kBakeOnlyFlag, 0, m_bakeOnly);
+    }
+    LOG_DEBUG("m_bakeOnly=" << m_bakeOnly);
+    if (m_bakeOnly) {
+        m_bakePlugNames.clear();
+        for (unsigned int i = 0; i < selList.length(); ++i) {
+            MPlug plug;
+            status = selList.getPlug(i, plug);
+            if (status != MS::kSuccess) {
+                MGlobal::displayWarning("animCurveMatch: Only attributes can be baked.");
+                return MStatus::kFailure;
+            }
+            m_bakePlugNames.append(plug.name());
+        }
+        if (m_bakePlugNames.length() == 0) {
+            MGlobal::displayWarning("animCurveMatch: No attributes given to bake.");
+            return MStatus::kFailure;
+        }
+        return MStatus::kSuccess;
+    }
+
+    // Get 'Reduce', a reduction only needs the source curve.
+    m_reduce = kReduceDefaultValue;
+    if (argData.isFlagSet(kReduceFlag)) {
+        status = argData.getFlagArgument(kReduceFlag, 0, m_reduce);
+    }
+
+    // Get 'Sweep', like a reduction only the source curve is needed.
+    m_sweep = kSweepDefaultValue;
+    if (argData.isFlagSet(kSweepFlag)) {
+        status = argData.getFlagArgument(kSweepFlag, 0, m_sweep);
+    }
+    if (m_reduce && m_sweep) {
+        MGlobal::displayWarning("animCurveMatch: Reduce and sweep cannot be used together.");
+        return MStatus::kFailure;
+    }
+
     int count = selList.length();
-    if (count != 2) {
+    if ((count != 2) && !((m_reduce || m_sweep) && (count == 1))) {
         ERR("2 animCurve objects must be given.");
         MGlobal::displayWarning("2 animCurve objects must be given.");
         return MStatus::kFailure;
     }
 
+    // The source is an animCurve, or an attribute which is baked.
     MObject srcCurve;
     status = selList.getDependNode(0, srcCurve);
     CHECK_MSTATUS_AND_RETURN_IT(status);
     MFnDependencyNode srcNodeFn(srcCurve);
     m_srcCurveName = srcNodeFn.name(&status);
     CHECK_MSTATUS_AND_RETURN_IT(status);
+    m_srcPlugName = "";
+    MPlug srcPlug;
+    if (selList.getPlug(0, srcPlug) == MS::kSuccess) {
+        m_srcPlugName = srcPlug.name();
+    }
+    if ((m_srcPlugName.length() > 0) && (m_reduce || (count != 2))) {
+        MGlobal::displayWarning("animCurveMatch: An attribute source needs a destination animCurve, and cannot be reduced.");
+        return MStatus::kFailure;
+    }
 
-    MObject dstCurve;
-    status = selList.getDependNode(1, dstCurve);
-    CHECK_MSTATUS_AND_RETURN_IT(status);
-    MFnDependencyNode dstNodeFn(dstCurve);
-    m_dstCurveName = dstNodeFn.name(&status);
-    CHECK_MSTATUS_AND_RETURN_IT(status);
+    // Without a destination, the reduced curve is a copy of the source.
+    m_dstCurveName = m_srcCurveName;
+    if (count == 2) {
+        MObject dstCurve;
+        status = selList.getDependNode(1, dstCurve);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        MFnDependencyNode dstNodeFn(dstCurve);
+        m_dstCurveName = dstNodeFn.name(&status);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
 
-    INFO("srcCurve node name=" << m_srcCurveName);
-    INFO("dstCurve node name=" << m_dstCurveName);
+    LOG_DEBUG("srcCurve node name=" << m_srcCurveName);
+    LOG_DEBUG("srcPlug name=" << m_srcPlugName);
+    LOG_DEBUG("dstCurve node name=" << m_dstCurveName);
 
     // Get 'Name'
     m_name = m_srcCurveName + "_solved";
     if (argData.isFlagSet(kNameFlag)) {
         status = argData.getFlagArgument(kNameFlag, 0, m_name);
     }
-    INFO("m_name=" << m_name);
+    LOG_DEBUG("m_name=" << m_name);
 
     // Get 'Iterations'
     m_iterations = kIterationsDefaultValue;
     if (argData.isFlagSet(kIterationsFlag)) {
         status = argData.getFlagArgument(kIterationsFlag, 0, m_iterations);
     }
-    INFO("m_iterations=" << m_iterations);
+    LOG_DEBUG("m_iterations=" << m_iterations);
 
     // Get 'Adjust Values'
     m_adjustValues = kAdjustValuesDefaultValue;
     if (argData.isFlagSet(kAdjustValuesFlag)) {
         status = argData.getFlagArgument(kAdjustValuesFlag, 0, m_adjustValues);
     }
-    INFO("m_adjustValues=" << m_adjustValues);
+    LOG_DEBUG("m_adjustValues=" << m_adjustValues);
 
     // Get 'Adjust Times'
     m_adjustTimes = kAdjustTimesDefaultValue;
     if (argData.isFlagSet(kAdjustTimesFlag)) {
         status = argData.getFlagArgument(kAdjustTimesFlag, 0, m_adjustTimes);
     }
-    INFO("m_adjustTimes=" << m_adjustTimes);
+    LOG_DEBUG("m_adjustTimes=" << m_adjustTimes);
 
     // Get 'Adjust Tangent Angles'
     m_adjustTangentAngles = kAdjustTangentAnglesDefaultValue;
     if (argData.isFlagSet(kAdjustTangentAnglesFlag)) {
         status = argData.getFlagArgument(kAdjustTangentAnglesFlag, 0, m_adjustTangentAngles);
     }
-    INFO("m_adjustTangentAngles=" << m_adjustTangentAngles);
+    LOG_DEBUG("m_adjustTangentAngles=" << m_adjustTangentAngles);
 
     // Get 'Adjust Tangent Weights'
     m_adjustTangentWeights = kAdjustTangentWeightsDefaultValue;
     if (argData.isFlagSet(kAdjustTangentWeightsFlag)) {
         status = argData.getFlagArgument(kAdjustTangentWeightsFlag, 0, m_adjustTangentWeights);
     }
-    INFO("m_adjustTangentWeights=" << m_adjustTangentWeights);
+    LOG_DEBUG("m_adjustTangentWeights=" << m_adjustTangentWeights);
 
     // Get 'Force Whole Frames'
     m_scaleTimeKeys = kScaleTimeKeysDefaultValue;
     if (argData.isFlagSet(kScaleTimeKeysFlag)) {
         status = argData.getFlagArgument(kScaleTimeKeysFlag, 0, m_scaleTimeKeys);
     }
-    INFO("m_scaleTimeKeys=" << m_scaleTimeKeys);
+    LOG_DEBUG("m_scaleTimeKeys=" << m_scaleTimeKeys);
 
     // Get 'Force Whole Frames'
     m_forceWholeFrames = kForceWholeFramesDefaultValue;
     if (argData.isFlagSet(kForceWholeFramesFlag)) {
         status = argData.getFlagArgument(kForceWholeFramesFlag, 0, m_forceWholeFrames);
     }
-    INFO("m_forceWholeFrames=" << m_forceWholeFrames);
+    LOG_DEBUG("m_forceWholeFrames=" << m_forceWholeFrames);
 
     // Get 'Add Keys'
     m_addKeys = kAddKeysDefaultValue;
     if (argData.isFlagSet(kAddKeysFlag)) {
         status = argData.getFlagArgument(kAddKeysFlag, 0, m_addKeys);
     }
-    INFO("m_addKeys=" << m_addKeys);
+    LOG_DEBUG("m_addKeys=" << m_addKeys);
 
     // Get 'New Curve'
     m_createNewCurve = kNewCurveDefaultValue;
     if (argData.isFlagSet(kNewCurveFlag)) {
         status = argData.getFlagArgument(kNewCurveFlag, 0, m_createNewCurve);
     }
-    INFO("m_createNewCurve=" << m_createNewCurve);
+    if ((m_reduce || m_sweep) && (count == 1)) {
+        m_createNewCurve = true;
+    }
+    LOG_DEBUG("m_createNewCurve=" << m_createNewCurve);
+    LOG_DEBUG("m_reduce=" << m_reduce);
+    LOG_DEBUG("m_sweep=" << m_sweep);
+
+    // Get 'Tolerance'
+    m_tolerance = kToleranceDefaultValue;
+    if (argData.isFlagSet(kToleranceFlag)) {
+        status = argData.getFlagArgument(kToleranceFlag, 0, m_tolerance);
+    }
+    LOG_DEBUG("m_tolerance=" << m_tolerance);
+
+    // Get 'Min Keys'
+    m_minKeys = kMinKeysDefaultValue;
+    if (argData.isFlagSet(kMinKeysFlag)) {
+        status = argData.getFlagArgument(kMinKeysFlag, 0, m_minKeys);
+    }
+    LOG_DEBUG("m_minKeys=" << m_minKeys);
+
+    // Get 'Max Keys'
+    m_maxKeys = kMaxKeysDefaultValue;
+    if (argData.isFlagSet(kMaxKeysFlag)) {
+        status = argData.getFlagArgument(kMaxKeysFlag, 0, m_maxKeys);
+    }
+    LOG_DEBUG("m_maxKeys=" << m_maxKeys);
+    if (m_sweep && (m_maxKeys < std::max(m_minKeys, 2u))) {
+        MGlobal::displayWarning("animCurveMatch: The maximum keyframe count must be at least the minimum (and 2).");
+        return MStatus::kFailure;
+    }
+
+    // Get 'Restarts'
+    m_restarts = kRestartsDefaultValue;
+    if (argData.isFlagSet(kRestartsFlag)) {
+        status = argData.getFlagArgument(kRestartsFlag, 0, m_restarts);
+    }
+    LOG_DEBUG("m_restarts=" << m_restarts);
+
+    // Get 'Direct Solve'
+    m_directSolve = kDirectSolveDefaultValue;
+    if (argData.isFlagSet(kDirectSolveFlag)) {
+        status = argData.getFlagArgument(kDirectSolveFlag, 0, m_directSolve);
+    }
+    LOG_DEBUG("m_directSolve=" << m_directSolve);
+
+    // Get 'Polish Iterations'
+    m_polishIterations = kPolishIterationsDefaultValue;
+    if (argData.isFlagSet(kPolishIterationsFlag)) {
+        status = argData.getFlagArgument(kPolishIterationsFlag, 0, m_polishIterations);
+    }
+    LOG_DEBUG("m_polishIterations=" << m_polishIterations);
+
+    // Get 'Streamed'
+    m_streamed = kStreamedDefaultValue;
+    if (argData.isFlagSet(kStreamedFlag)) {
+        status = argData.getFlagArgument(kStreamedFlag, 0, m_streamed);
+    }
+    LOG_DEBUG("m_streamed=" << m_streamed);
+
+    // Get 'Time Budget'
+    m_timeBudget = kTimeBudgetDefaultValue;
+    if (argData.isFlagSet(kTimeBudgetFlag)) {
+        status = argData.getFlagArgument(kTimeBudgetFlag, 0, m_timeBudget);
+    }
+    LOG_DEBUG("m_timeBudget=" << m_timeBudget);
+
+    // Get 'Target RMS Error'
+    m_targetRmsError = kTargetRmsErrorDefaultValue;
+    if (argData.isFlagSet(kTargetRmsErrorFlag)) {
+        status = argData.getFlagArgument(kTargetRmsErrorFlag, 0, m_targetRmsError);
+    }
+    LOG_DEBUG("m_targetRmsError=" << m_targetRmsError);
+
+    // Get 'Target Max Error'
+    m_targetMaxError = kTargetMaxErrorDefaultValue;
+    if (argData.isFlagSet(kTargetMaxErrorFlag)) {
+        status = argData.getFlagArgument(kTargetMaxErrorFlag, 0, m_targetMaxError);
+    }
+    LOG_DEBUG("m_targetMaxError=" << m_targetMaxError);
+
+    // Get 'Error Report'
+    m_errorReport = kErrorReportDefaultValue;
+    if (argData.isFlagSet(kErrorReportFlag)) {
+        status = argData.getFlagArgument(kErrorReportFlag, 0, m_errorReport);
+    }
+    LOG_DEBUG("m_errorReport=" << m_errorReport);
+
+    // Get 'Covariance'
+    m_covariance = kCovarianceDefaultValue;
+    if (argData.isFlagSet(kCovarianceFlag)) {
+        status = argData.getFlagArgument(kCovarianceFlag, 0, m_covariance);
+    }
+    LOG_DEBUG("m_covariance=" << m_covariance);
+
+    // Get 'Incremental'
+    m_incremental = kIncrementalDefaultValue;
+    if (argData.isFlagSet(kIncrementalFlag)) {
+        status = argData.getFlagArgument(kIncrementalFlag, 0, m_incremental);
+    }
+    LOG_DEBUG("m_incremental=" << m_incremental);
+
+    // Get 'Changed Keys', may be given many times.
+    m_changedKeys.clear();
+    unsigned int changedKeysCount = argData.numberOfFlagUses(kChangedKeysFlag);
+    for (unsigned int i = 0; i < changedKeysCount; ++i) {
+        MArgList flagArgs;
+        status = argData.getFlagArgumentList(kChangedKeysFlag, i, flagArgs);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        int index = flagArgs.asInt(0, &status);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        m_changedKeys.append(index);
+    }
+    LOG_DEBUG("m_changedKeys=" << m_changedKeys.length());
+
+    // Get 'Neighbourhood'
+    m_neighbourhood = kNeighbourhoodDefaultValue;
+    if (argData.isFlagSet(kNeighbourhoodFlag)) {
+        status = argData.getFlagArgument(kNeighbourhoodFlag, 0, m_neighbourhood);
+    }
+    LOG_DEBUG("m_neighbourhood=" << m_neighbourhood);
+
+    if (m_incremental && (m_changedKeys.length() == 0)) {
+        ERR("An incremental solve needs at least one changed keyframe.");
+        MGlobal::displayWarning("animCurveMatch: An incremental solve needs at least one changed keyframe.");
+        return MStatus::kFailure;
+    }
+    if (m_incremental && (m_reduce || m_sweep)) {
+        MGlobal::displayWarning("animCurveMatch: An incremental solve cannot reduce or sweep keyframes.");
+        return MStatus::kFailure;
+    }
+
+    // Get 'Async'
+    m_async = kAsyncDefaultValue;
+    if (argData.isFlagSet(kAsyncFlag)) {
+        status = argData.getFlagArgument(kAsyncFlag, 0, m_async);
+    }
+    LOG_DEBUG("m_async=" << m_async);
+    if (m_async && isSolveJobRunning(true)) {
+        MGlobal::displayWarning("animCurveMatch: Cannot start a background job while a traced job is running.");
+        return MStatus::kFailure;
+    }
+
+    // Get 'Dry Run'
+    m_dryRun = kDryRunDefaultValue;
+    if (argData.isFlagSet(kDryRunFlag)) {
+        status = argData.getFlagArgument(kDryRunFlag, 0, m_dryRun);
+    }
+    LOG_DEBUG("m_dryRun=" << m_dryRun);
+    if (m_dryRun && m_async) {
+        MGlobal::displayWarning("animCurveMatch: A dry run cannot be asynchronous.");
+        return MStatus::kFailure;
+    }
+
+    // Get 'Export Job'
+    m_exportJob = "";
+    if (argData.isFlagSet(kExportJobFlag)) {
+        status = argData.getFlagArgument(kExportJobFlag, 0, m_exportJob);
+    }
+    LOG_DEBUG("m_exportJob=" << m_exportJob);
+    if ((m_exportJob.length() > 0) && (m_dryRun || m_async)) {
+        MGlobal::displayWarning("animCurveMatch: An exported job cannot be a dry run or asynchronous.");
+        return MStatus::kFailure;
+    }
 
     return status;
 }
@@ -182,31 +507,67 @@ MStatus animCurveMatchCmd::doIt(const MArgList &args) {
 //    argList - the argument list that was passes to the command from MEL
 //
 //  Return Value:
+//    The command result is the RMS sample error of the solve (the
+//    maximum error with -reduce), see the README for the other modes.
+//
 //    MS::kSuccess - command succeeded
 //    MS::kFailure - command failed (returning this value will cause the
 //                     MEL script that is being run to terminate unless the
 //                     error is caught using a "catch" statement.
 //
     MStatus status = MStatus::kSuccess;
-    INFO("animCurveMatchCmd::doIt()");
+    LOG_DEBUG("animCurveMatchCmd::doIt()");
 
     // The animation curves will be changed by many individual calls, so we tell
     // Maya not to store each call, but only the final result of the calls.
     m_animChange.setInteractive(false);
 
     // Read all the flag arguments.
+    m_isUndoable = false;
     status = parseArgs(args);
     CHECK_MSTATUS_AND_RETURN_IT(status);
 
+    if (m_jobStatus || m_cancelJob || m_applyJob) {
+        return doJobCommand();
+    }
+    if (m_bakeOnly) {
+        return doBakeCommand();
+    }
+    if (m_importResults.length() > 0) {
+        return doImportCommand();
+    }
+
     MSelectionList selList;
     selList.add(m_srcCurveName);
     selList.add(m_dstCurveName);
 
+    // Bake an attribute source (or read it from the cache), before
+    // anything is modified.
+    CurveSamples srcSamples;
+    bool sampledSource = m_srcPlugName.length() > 0;
+    if (sampledSource) {
+        MSelectionList plugList;
+        MPlug srcPlug;
+        status = plugList.add(m_srcPlugName);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        status = plugList.getPlug(0, srcPlug);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        MPlugArray plugs;
+        plugs.append(srcPlug);
+        std::vector<CurveSamples> samples;
+        unsigned int numBaked = 0;
+        status = bakeCachedPlugs(plugs, m_startFrame, m_endFrame, m_cacheDir, samples, numBaked);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        srcSamples = samples[0];
+    }
+
     MObject srcCurve;
     status = selList.getDependNode(0, srcCurve);
     CHECK_MSTATUS_AND_RETURN_IT(status);
     MFnAnimCurve srcAnimCurveFn(srcCurve, &status);
-    CHECK_MSTATUS_AND_RETURN_IT(status);
+    if (!sampledSource) {
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+    }
 
     MObject dstCurve;
     status = selList.getDependNode(1, dstCurve);
@@ -215,8 +576,10 @@ MStatus animCurveMatchCmd::doIt(const MArgList &args) {
     CHECK_MSTATUS_AND_RETURN_IT(status);
 
     // Duplicate destination curve, so we modify it, rather than the destination curve.
+    // A dry run does not modify either.
+    bool exportJob = m_exportJob.length() > 0;
     MObject newCurve = dstCurve;
-    if (m_createNewCurve) {
+    if (m_createNewCurve && !m_dryRun) {
         MString dstAnimCurveName = dstAnimCurveFn.name(&status);
         CHECK_MSTATUS_AND_RETURN_IT(status);
         MDGModifier dgMod;
@@ -270,27 +633,330 @@ MStatus animCurveMatchCmd::doIt(const MArgList &args) {
         CHECK_MSTATUS_AND_RETURN_IT(status);
     }
 
-    int iterMax = m_iterations;
+    SolverOptions options;
+    options.iterMax = m_iterations;
+    options.adjustValues = m_adjustValues;
+    options.adjustTimes = m_adjustTimes;
+    options.adjustTangentAngles = m_adjustTangentAngles;
+    options.adjustTangentWeights = m_adjustTangentWeights;
+    options.scaleTimeKeys = m_scaleTimeKeys;
+    options.forceWholeFrames = m_forceWholeFrames;
+    options.addKeys = m_addKeys;
+    options.restarts = m_restarts;
+    options.directSolve = m_directSolve;
+    options.polishIterations = m_polishIterations;
+    options.streamed = m_streamed;
+    options.covariance = m_covariance;
+    options.timeBudget = m_timeBudget;
+    options.targetRmsError = m_targetRmsError;
+    options.targetMaxError = m_targetMaxError;
+    options.cancel = NULL;
+
+    // Only re-solve the keyframes near the changed keyframes of the
+    // previous solution, the other keyframes are kept fixed.
+    // Each group of nearby changed keyframes is solved on its own, and
+    // 'firstKey' to 'lastKey' span all of them, for writing back.
+    // Making the curve weighted would change the fixed keyframes too.
+    if (m_incremental && options.adjustTangentWeights && !dstAnimCurveFn.isWeighted()) {
+        MGlobal::displayWarning("animCurveMatch: An incremental solve of tangent weights needs a weighted destination curve.");
+        return MStatus::kFailure;
+    }
+    if (m_incremental) {
+        std::vector<int> changedKeys;
+        for (unsigned int i = 0; i < m_changedKeys.length(); ++i) {
+            changedKeys.push_back(m_changedKeys[i]);
+        }
+        makeKeyRanges(changedKeys, (int) m_neighbourhood, (int) dstAnimCurveFn.numKeys(), options.keyRanges);
+        if (options.keyRanges.empty()) {
+            MGlobal::displayWarning("animCurveMatch: No changed keyframe is on the destination curve.");
+            return MStatus::kFailure;
+        }
+        options.firstKey = options.keyRanges.front();
+        options.lastKey = options.keyRanges.back();
+        LOG_DEBUG("Incremental keyframe ranges: " << options.keyRanges.size() / 2
+                                                  << ", from " << options.firstKey << " to " << options.lastKey);
+    }
+
+    if ((m_traceFile.length() > 0) && !exportJob) {
+        debug::beginTrace();
+    }
+
+    // Solve snapshots of the curves on a worker thread, the result is
+    // applied later when Maya is idle. Returns the job id. A dry run
+    // solves the snapshots right away and returns the solved keyframes,
+    // nothing is created or modified so there is nothing to undo. An
+    // exported job is appended to a manifest, for 'animCurveMatchBatch'.
+    if (m_async || m_dryRun || exportJob) {
+        std::shared_ptr<SolveJob> job(new SolveJob());
+        MFnAnimCurve newCurveFn(newCurve, &status);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        job->dstCurveName = newCurveFn.name().asChar();
+        if (sampledSource) {
+            job->srcSamples = srcSamples;
+        } else {
+            status = readCurveKeys(srcAnimCurveFn, job->srcKeys);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+        }
+        status = readCurveKeys(newCurveFn, job->dstKeys);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        job->options = options;
+        job->reduce = m_reduce;
+        job->sweep = m_sweep;
+        job->minKeys = m_minKeys;
+        job->maxKeys = m_maxKeys;
+        job->framesPerSecond = MTime(1.0, MTime::kSeconds).asUnits(MTime::uiUnit());
+        job->tolerance = m_tolerance;
+        job->traceFile = m_traceFile.asChar();
+
+        if (exportJob) {
+            if (!appendManifestJob(m_exportJob.asChar(), *job)) {
+                MGlobal::displayWarning("animCurveMatch: Could not write manifest: " + m_exportJob);
+                return MStatus::kFailure;
+            }
+            return status;
+        }
+
+        if (m_dryRun) {
+            bool ret = solveCurveJob(*job);
+            if (m_traceFile.length() > 0) {
+                if (!debug::endTrace(m_traceFile.asChar())) {
+                    WRN("animCurveMatch: Could not write trace file: " << m_traceFile);
+                }
+            }
+            if (ret == false) {
+                WRN("animCurveMatch: Solver returned false!");
+                animCurveMatchCmd::setResult(job->error);
+                return status;
+            }
+            MDoubleArray result;
+            curveKeysToArray(job->error, job->dstKeys, result);
+            animCurveMatchCmd::setResult(result);
+            return status;
+        }
+
+        int jobId = startSolveJob(job);
+        animCurveMatchCmd::setResult(jobId);
+        return status;
+    }
+    m_isUndoable = true;
+
     double outError = -1.0;
-    bool ret = solveCurveFit(iterMax,
-                             srcCurve,
+    ErrorReport report;
+    ErrorReport *outReport = (m_errorReport || m_covariance) ? &report : NULL;
+    bool ret = false;
+    if (m_sweep) {
+        CurveKeys srcKeys;
+        CurveSource source;
+        if (sampledSource) {
+            source.samples = &srcSamples;
+        } else {
+            status = readCurveKeys(srcAnimCurveFn, srcKeys);
+            CHECK_MSTATUS_AND_RETURN_IT(status);
+            source.keys = &srcKeys;
+        }
+        ret = sweepCurveFit(source,
+                            newCurve,
+                            m_animChange,
+                            options,
+                            m_minKeys,
+                            m_maxKeys,
+                            m_tolerance,
+                            outError);
+    } else if (sampledSource) {
+        ret = solveSampledCurveFit(srcSamples,
+                                   newCurve,
+                                   m_animChange,
+                                   options,
+                                   outError,
+                                   outReport);
+    } else if (m_reduce) {
+        ret = reduceCurveFit(srcCurve,
                              newCurve,
                              m_animChange,
-                             m_adjustValues,
-                             m_adjustTimes,
-                             m_adjustTangentAngles,
-                             m_adjustTangentWeights,
-                             m_scaleTimeKeys,
-                             m_forceWholeFrames,
-                             m_addKeys,
-                             outError);
-    animCurveMatchCmd::setResult(outError);
+                             options,
+                             m_tolerance,
+                             outError,
+                             outReport);
+    } else {
+        ret = solveCurveFit(srcCurve,
+                            newCurve,
+                            m_animChange,
+                            options,
+                            outError,
+                            outReport);
+    }
+    if (m_traceFile.length() > 0) {
+        if (!debug::endTrace(m_traceFile.asChar())) {
+            WRN("animCurveMatch: Could not write trace file: " << m_traceFile);
+        }
+    }
+
+    if (m_sweep && ret) {
+        // The chosen keyframe count and its maximum error.
+        MFnAnimCurve newCurveFn(newCurve);
+        MDoubleArray result;
+        result.append(double(newCurveFn.numKeys()));
+        result.append(outError);
+        animCurveMatchCmd::setResult(result);
+    } else if ((m_errorReport || m_covariance) && ret) {
+        MDoubleArray result;
+        if (m_errorReport) {
+            errorReportToArray(report, result);
+        } else {
+            result.append(outError);
+        }
+        if (m_covariance) {
+            keyCovarianceToArray(report, result);
+        }
+        animCurveMatchCmd::setResult(result);
+    } else {
+        animCurveMatchCmd::setResult(outError);
+    }
     if (ret == false) {
         WRN("animCurveMatch: Solver returned false!");
     }
     return status;
 }
 
+/*
+ * Query, cancel or apply a background solve job.
+ */
+MStatus animCurveMatchCmd::doJobCommand() {
+    MStatus status = MStatus::kSuccess;
+    std::shared_ptr<SolveJob> job = findSolveJob((int) m_jobId);
+
+    if (m_jobStatus) {
+        int state = findSolveJobState((int) m_jobId);
+        animCurveMatchCmd::setResult(MString(solveJobStateName(state)));
+        return status;
+    }
+
+    if (!job) {
+        MString msg = "animCurveMatch: No job with id ";
+        msg += m_jobId;
+        MGlobal::displayWarning(msg);
+        return MStatus::kFailure;
+    }
+
+    // The worker may finish at the same time, whichever changes the
+    // state first wins.
+    if (m_cancelJob) {
+        job->cancel.store(true);
+        int state = kJobRunning;
+        if (!job->state.compare_exchange_strong(state, kJobCancelled)) {
+            state = kJobDone;
+            job->state.compare_exchange_strong(state, kJobCancelled);
+        }
+        return status;
+    }
+
+    // Apply the job result as a single undoable change.
+    if (job->state.load() != kJobDone) {
+        MString msg = "animCurveMatch: Job is not ready to apply: ";
+        msg += solveJobStateName(job->state.load());
+        MGlobal::displayWarning(msg);
+        return MStatus::kFailure;
+    }
+
+    MSelectionList selList;
+    MObject dstCurve;
+    status = selList.add(job->dstCurveName.c_str());
+    if (status == MS::kSuccess) {
+        status = selList.getDependNode(0, dstCurve);
+    }
+    if (status == MS::kSuccess) {
+        status = applySolvedCurveKeys(dstCurve, job->dstKeys, job->options, job->replacesKeys(), m_animChange);
+    }
+    if (status != MS::kSuccess) {
+        job->state.store(kJobFailed);
+        removeSolveJob(job->id);
+        MGlobal::displayWarning(MString("animCurveMatch: Could not apply job to ") + job->dstCurveName.c_str());
+        return status;
+    }
+    job->state.store(kJobApplied);
+    removeSolveJob(job->id);
+
+    m_isUndoable = true;
+    animCurveMatchCmd::setResult(job->error);
+    return status;
+}
+
+/*
+ * Apply the solved jobs of a batch results file, all as a single
+ * undoable change.
+ */
+MStatus animCurveMatchCmd::doImportCommand() {
+    MStatus status = MStatus::kSuccess;
+    std::vector<JobResult> results;
+    if (!readResultsFile(m_importResults.asChar(), results)) {
+        MGlobal::displayWarning("animCurveMatch: Could not read results: " + m_importResults);
+        return MStatus::kFailure;
+    }
+
+    int numApplied = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        CurveJob &job = results[i].job;
+        MString dstCurveName(job.dstCurveName.c_str());
+        if (!results[i].solved) {
+            MGlobal::displayWarning("animCurveMatch: Job was not solved, skipping " + dstCurveName);
+            continue;
+        }
+
+        MSelectionList selList;
+        MObject dstCurve;
+        status = selList.add(dstCurveName);
+        if (status == MS::kSuccess) {
+            status = selList.getDependNode(0, dstCurve);
+        }
+        if (status == MS::kSuccess) {
+            status = applySolvedCurveKeys(dstCurve, job.dstKeys, job.options, job.replacesKeys(), m_animChange);
+        }
+        if (status != MS::kSuccess) {
+            MGlobal::displayWarning("animCurveMatch: Could not apply result to " + dstCurveName);
+            continue;
+        }
+        numApplied += 1;
+    }
+    status = MStatus::kSuccess;
+
+    // Number of results applied.
+    m_isUndoable = numApplied > 0;
+    animCurveMatchCmd::setResult(numApplied);
+    return status;
+}
+
+/*
+ * Bake attributes into the disk cache, without solving.
+ */
+MStatus animCurveMatchCmd::doBakeCommand() {
+    MStatus status = MStatus::kSuccess;
+    MPlugArray plugs;
+    for (unsigned int i = 0; i < m_bakePlugNames.length(); ++i) {
+        MSelectionList selList;
+        MPlug plug;
+        status = selList.add(m_bakePlugNames[i]);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        status = selList.getPlug(0, plug);
+        CHECK_MSTATUS_AND_RETURN_IT(status);
+        plugs.append(plug);
+    }
+
+    if (m_traceFile.length() > 0) {
+        debug::beginTrace();
+    }
+    std::vector<CurveSamples> samples;
+    unsigned int numBaked = 0;
+    status = bakeCachedPlugs(plugs, m_startFrame, m_endFrame, m_cacheDir, samples, numBaked);
+    if (m_traceFile.length() > 0) {
+        debug::endTrace(m_traceFile.asChar());
+    }
+    CHECK_MSTATUS_AND_RETURN_IT(status);
+
+    // Number of attributes evaluated, the others were in the cache.
+    animCurveMatchCmd::setResult((int) numBaked);
+    return status;
+}
+
 MStatus animCurveMatchCmd::redoIt() {
 //
 //  Description:
@@ -0,0 +1,225 @@
+/*
+ * Background solve jobs, solved on worker threads and applied on the
+ * main thread from an idle callback.
+ */
+
+
+//
+#include <animCurveMatchJobs.h>
+#include <animCurveMatchCmd.h>
+
+// STL
+#include <map>       // map
+#include <mutex>     // mutex, lock_guard
+#include <vector>    // vector
+
+// Maya
+#include <maya/MGlobal.h>
+#include <maya/MEventMessage.h>
+#include <maya/MMessage.h>
+
+// Utils
+#include <utilities/debugUtils.h>
+
+
+namespace {
+
+    // All jobs, the final states of removed jobs, and the idle
+    // callback applying finished jobs. Only the main thread adds or
+    // removes jobs, or (un)registers the callback.
+    std::mutex g_jobsMutex;
+    std::map<int, std::shared_ptr<SolveJob> > g_jobs;
+    std::map<int, int> g_removedJobStates;
+    int g_nextJobId = 1;
+    MCallbackId g_idleCallbackId = 0;
+    bool g_idleCallbackSet = false;
+
+
+    // Worker thread, only uses the job's snapshots. The final state is
+    // only set if the job was not cancelled in the meantime.
+    void runSolveJob(std::shared_ptr<SolveJob> job) {
+        bool ret = solveCurveJob(*job);
+        if (!job->traceFile.empty()) {
+            debug::endTrace(job->traceFile);
+        }
+
+        int finalState = kJobFailed;
+        if (job->cancel.load()) {
+            finalState = kJobCancelled;
+        } else if (ret) {
+            finalState = kJobDone;
+        }
+        int state = kJobRunning;
+        job->state.compare_exchange_strong(state, finalState);
+        job->finished.store(true);
+    }
+
+
+    // Forget a job, keeping only its state. 'g_jobsMutex' must be locked.
+    void eraseSolveJob(std::map<int, std::shared_ptr<SolveJob> >::iterator it) {
+        SolveJob &job = *it->second;
+        if (job.thread.joinable()) {
+            job.thread.join();
+        }
+        g_removedJobStates[job.id] = job.state.load();
+        g_jobs.erase(it);
+    }
+
+
+    // Apply finished jobs on the main thread, each as its own undoable
+    // command. The callback removes itself once no job is running.
+    void applyFinishedJobs(void * /*clientData*/) {
+        std::vector<int> finished;
+        bool running = false;
+        {
+            std::lock_guard<std::mutex> lock(g_jobsMutex);
+            std::map<int, std::shared_ptr<SolveJob> >::iterator it = g_jobs.begin();
+            while (it != g_jobs.end()) {
+                SolveJob &job = *it->second;
+                if (!job.finished.load()) {
+                    running = true;
+                    ++it;
+                    continue;
+                }
+                int state = job.state.load();
+                if ((state == kJobDone) && !job.applyQueued) {
+                    job.applyQueued = true;
+                    finished.push_back(job.id);
+                }
+                if ((state == kJobFailed) || (state == kJobCancelled)) {
+                    eraseSolveJob(it++);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < finished.size(); ++i) {
+            MString cmd;
+            cmd += kCommandName;
+            cmd += " ";
+            cmd += kApplyJobFlag;
+            cmd += " ";
+            cmd += finished[i];
+            cmd += ";";
+            MStatus status = MGlobal::executeCommand(cmd, false, true);
+            if (status != MS::kSuccess) {
+                WRN("animCurveMatch: Could not apply job " << finished[i] << ".");
+            }
+        }
+
+        if (!running && g_idleCallbackSet) {
+            MMessage::removeCallback(g_idleCallbackId);
+            g_idleCallbackSet = false;
+        }
+    }
+
+}
+
+
+int startSolveJob(std::shared_ptr<SolveJob> job) {
+    {
+        std::lock_guard<std::mutex> lock(g_jobsMutex);
+        job->id = g_nextJobId++;
+        job->options.cancel = &job->cancel;
+        job->state.store(kJobRunning);
+        g_jobs[job->id] = job;
+        job->thread = std::thread(runSolveJob, job);
+    }
+
+    if (!g_idleCallbackSet) {
+        MStatus status;
+        g_idleCallbackId = MEventMessage::addEventCallback("idle", applyFinishedJobs, NULL, &status);
+        g_idleCallbackSet = status == MS::kSuccess;
+        if (!g_idleCallbackSet) {
+            WRN("animCurveMatch: Could not add idle callback, jobs will not be applied.");
+        }
+    }
+    return job->id;
+}
+
+
+std::shared_ptr<SolveJob> findSolveJob(int id) {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    std::map<int, std::shared_ptr<SolveJob> >::iterator it = g_jobs.find(id);
+    if (it == g_jobs.end()) {
+        return std::shared_ptr<SolveJob>();
+    }
+    return it->second;
+}
+
+
+int findSolveJobState(int id) {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    std::map<int, std::shared_ptr<SolveJob> >::iterator it = g_jobs.find(id);
+    if (it != g_jobs.end()) {
+        return it->second->state.load();
+    }
+    std::map<int, int>::iterator removed = g_removedJobStates.find(id);
+    if (removed != g_removedJobStates.end()) {
+        return removed->second;
+    }
+    return -1;
+}
+
+
+void removeSolveJob(int id) {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    std::map<int, std::shared_ptr<SolveJob> >::iterator it = g_jobs.find(id);
+    if (it != g_jobs.end()) {
+        eraseSolveJob(it);
+    }
+}
+
+
+bool isSolveJobRunning(bool traced) {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    std::map<int, std::shared_ptr<SolveJob> >::iterator it;
+    for (it = g_jobs.begin(); it != g_jobs.end(); ++it) {
+        const SolveJob &job = *it->second;
+        if (!job.finished.load() && (!traced || !job.traceFile.empty())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char *solveJobStateName(int state) {
+    switch (state) {
+        case kJobRunning:
+            return "running";
+        case kJobDone:
+            return "done";
+        case kJobApplied:
+            return "applied";
+        case kJobFailed:
+            return "failed";
+        case kJobCancelled:
+            return "cancelled";
+        default:
+            break;
+    }
+    return "unknown";
+}
+
+
+void stopAllSolveJobs() {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    std::map<int, std::shared_ptr<SolveJob> >::iterator it;
+    for (it = g_jobs.begin(); it != g_jobs.end(); ++it) {
+        it->second->cancel.store(true);
+    }
+    for (it = g_jobs.begin(); it != g_jobs.end(); ++it) {
+        if (it->second->thread.joinable()) {
+            it->second->thread.join();
+        }
+    }
+    g_jobs.clear();
+    g_removedJobStates.clear();
+
+    if (g_idleCallbackSet) {
+        MMessage::removeCallback(g_idleCallbackId);
+        g_idleCallbackSet = false;
+    }
+}
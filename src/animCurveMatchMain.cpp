@@ -5,6 +5,7 @@
 
 #include <maya/MFnPlugin.h>
 #include <animCurveMatchCmd.h>
+#include <animCurveMatchJobs.h>
 
 
 // Register command with system
@@ -28,6 +29,9 @@ MStatus uninitializePlugin(MObject obj) {
     MStatus status;
     MFnPlugin plugin(obj);
 
+    // Worker threads must not outlive the plug-in.
+    stopAllSolveJobs();
+
     status = plugin.deregisterCommand(kCommandName);
     if (!status) {
         status.perror("animCurveMatch: deregisterCommand");
@@ -4,6 +4,7 @@ try:
 except RuntimeError:
     pass
 import math
+import time
 import maya.cmds
 
 
@@ -71,4 +72,57 @@ print 'after:', maya.cmds.keyframe(tfm,
                                    attribute='translateX',
                                    valueChange=True) or []
 
+# Keyframe reduction of the source, into a new curve.
+err = maya.cmds.animCurveMatch(srcCurve, reduce=True, tolerance=0.01, name='reducedCurve')
+print 'reduce max error:', err
+assert err <= 0.01 + 1e-6
+assert (maya.cmds.keyframe('reducedCurve', query=True, keyframeCount=True)
+        <= maya.cmds.keyframe(srcCurve, query=True, keyframeCount=True))
+
+# Background solve, applied once finished (the idle callback does not
+# run in a standalone session).
+job = maya.cmds.animCurveMatch(srcCurve, dstCurve, asynchronous=True)
+print 'job:', job
+status = maya.cmds.animCurveMatch(jobStatus=job)
+while status == 'running':
+    time.sleep(0.01)
+    status = maya.cmds.animCurveMatch(jobStatus=job)
+assert status == 'done', status
+err = maya.cmds.animCurveMatch(applyJob=job)
+print 'job error level:', err
+assert maya.cmds.animCurveMatch(jobStatus=job) == 'applied'
+
+# A cancelled background solve is never applied.
+job = maya.cmds.animCurveMatch(srcCurve, dstCurve, asynchronous=True)
+maya.cmds.animCurveMatch(cancelJob=job)
+assert maya.cmds.animCurveMatch(jobStatus=job) == 'cancelled'
+
+# Re-solve only the keyframes next to an edited keyframe; keyframes
+# outside the neighbourhood are not changed.
+maya.cmds.keyframe(dstCurve, index=(1, 1), valueChange=2.0, relative=True)
+before = maya.cmds.keyframe(dstCurve, query=True, valueChange=True)
+err = maya.cmds.animCurveMatch(srcCurve, dstCurve, incremental=True, changedKeys=[1], neighbourhood=0)
+print 'incremental error level:', err
+after = maya.cmds.keyframe(dstCurve, query=True, valueChange=True)
+assert len(after) == len(before)
+assert all(after[i] == before[i] for i in range(len(before)) if i != 1)
+
+# Key count sweep of the source, into a new curve.
+numKeys, maxError = maya.cmds.animCurveMatch(srcCurve, sweep=True, minKeys=2, maxKeys=8,
+                                             tolerance=0.01, name='sweptCurve')
+print 'sweep keyframes:', numKeys, 'max error:', maxError
+assert 2 <= numKeys <= 8
+assert maya.cmds.keyframe('sweptCurve', query=True, keyframeCount=True) == numKeys
+
+# A dry run returns the solved keyframes without changing the scene.
+before = maya.cmds.keyframe(dstCurve, query=True, valueChange=True)
+nodes = maya.cmds.ls(type='animCurve')
+result = maya.cmds.animCurveMatch(srcCurve, dstCurve, dryRun=True)
+numKeys = int(result[1])
+print 'dry run error level:', result[0], 'keyframes:', numKeys
+assert numKeys == len(before)
+assert len(result) == 2 + (6 * numKeys)
+assert maya.cmds.keyframe(dstCurve, query=True, valueChange=True) == before
+assert maya.cmds.ls(type='animCurve') == nodes
+
 # maya.cmds.quit(force=True)
\ No newline at end of file
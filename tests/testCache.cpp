@@ -0,0 +1,149 @@
+/*
+ * Baked samples read back from the disk cache exactly as written, and
+ * files baked with another key, another format, or cut short are not
+ * used.
+ */
+
+// STL
+#include <cmath>     // sin
+#include <cstdio>    // remove
+#include <string>    // string
+#include <fstream>   // ifstream, ofstream
+#include <sstream>   // stringstream
+
+// Utils
+#include <animCurveMatchCache.h>
+#include <testUtils.h>
+
+
+const char kTestCachePath[] = "testCache.bake";
+
+
+void makeCacheKey(BakeCacheKey &key) {
+    key.sceneFile = "/projects/shot010/scenes/anim_v003.ma";
+    key.plugName = "pCube1.translateX";
+    key.startFrame = -5.0;
+    key.endFrame = 44.0;
+    key.framesPerSecond = 30.0;
+}
+
+
+void makeCacheSamples(const BakeCacheKey &key, CurveSamples &samples) {
+    int numFrames = bakeFrameCount(key.startFrame, key.endFrame);
+    samples.times.resize(numFrames);
+    samples.values.resize(numFrames);
+    for (int i = 0; i < numFrames; ++i) {
+        samples.times[i] = key.startFrame + double(i);
+        samples.values[i] = std::sin(double(i) * 0.3) / 3.0;
+    }
+}
+
+
+std::string readFileText(const char *path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+
+void writeFileText(const char *path, const std::string &text) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << text;
+}
+
+
+void testCacheRoundTrip() {
+    BakeCacheKey key;
+    makeCacheKey(key);
+    CurveSamples samples;
+    makeCacheSamples(key, samples);
+    CHECK(writeBakeCache(kTestCachePath, key, samples));
+
+    CurveSamples readSamples;
+    CHECK(readBakeCache(kTestCachePath, key, readSamples));
+    CHECK(readSamples.times == samples.times);
+    CHECK(readSamples.values == samples.values);
+    std::remove(kTestCachePath);
+}
+
+
+// Each part of the key is checked, not only the file name.
+void testCacheKeyMismatch() {
+    BakeCacheKey key;
+    makeCacheKey(key);
+    CurveSamples samples;
+    makeCacheSamples(key, samples);
+    CHECK(writeBakeCache(kTestCachePath, key, samples));
+
+    CurveSamples readSamples;
+    BakeCacheKey otherKey = key;
+    otherKey.sceneFile = "/projects/shot010/scenes/anim_v004.ma";
+    CHECK(!readBakeCache(kTestCachePath, otherKey, readSamples));
+    otherKey = key;
+    otherKey.plugName = "pCube1.translateY";
+    CHECK(!readBakeCache(kTestCachePath, otherKey, readSamples));
+    otherKey = key;
+    otherKey.endFrame = 45.0;
+    CHECK(!readBakeCache(kTestCachePath, otherKey, readSamples));
+    otherKey = key;
+    otherKey.framesPerSecond = 24.0;
+    CHECK(!readBakeCache(kTestCachePath, otherKey, readSamples));
+
+    // Different keys are different files.
+    CHECK(bakeCachePath("cache", key) != bakeCachePath("cache", otherKey));
+    std::remove(kTestCachePath);
+}
+
+
+// A file with another magic or version is not read.
+void testCacheHeaderMismatch() {
+    BakeCacheKey key;
+    makeCacheKey(key);
+    CurveSamples samples;
+    makeCacheSamples(key, samples);
+    CHECK(writeBakeCache(kTestCachePath, key, samples));
+    std::string text = readFileText(kTestCachePath);
+
+    CurveSamples readSamples;
+    std::string badMagic = text;
+    badMagic[0] = 'X';
+    writeFileText(kTestCachePath, badMagic);
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+
+    std::string badVersion = text;
+    badVersion[sizeof(kBakeCacheMagic)] += 1;
+    writeFileText(kTestCachePath, badVersion);
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+    std::remove(kTestCachePath);
+}
+
+
+// A file cut short (such as by a full disk) is not read.
+void testCacheShortFile() {
+    BakeCacheKey key;
+    makeCacheKey(key);
+    CurveSamples samples;
+    makeCacheSamples(key, samples);
+    CHECK(writeBakeCache(kTestCachePath, key, samples));
+    std::string text = readFileText(kTestCachePath);
+
+    CurveSamples readSamples;
+    writeFileText(kTestCachePath, text.substr(0, text.size() - 1));
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+    writeFileText(kTestCachePath, text.substr(0, 10));
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+    writeFileText(kTestCachePath, "");
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+    std::remove(kTestCachePath);
+    CHECK(!readBakeCache(kTestCachePath, key, readSamples));
+}
+
+
+int main() {
+    testCacheRoundTrip();
+    testCacheKeyMismatch();
+    testCacheHeaderMismatch();
+    testCacheShortFile();
+    return testResult("testCache");
+}
@@ -0,0 +1,245 @@
+/*
+ * Weighted (Bezier) curve evaluation, converting curves to weighted,
+ * solving tangent weights, cycled infinity, and rounding key times to
+ * whole frames.
+ */
+
+// STL
+#include <cmath>     // sin, cos, tan, fabs
+
+// Utils
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+#include <testUtils.h>
+
+
+// A two keyframe weighted curve; the tangents are 'weight' * (cos,
+// sin) of the angle, in seconds and value.
+void makeWeightedSegment(double outAngle,
+                         double outWeight,
+                         double inAngle,
+                         double inWeight,
+                         CurveKeys &keys) {
+    keys.resize(2);
+    keys.framesPerSecond = 24.0;
+    keys.weighted = true;
+    keys.times[0] = 2.0;
+    keys.times[1] = 14.0;
+    keys.values[0] = 1.0;
+    keys.values[1] = -3.0;
+    keys.outAngles[0] = outAngle;
+    keys.outWeights[0] = outWeight;
+    keys.inAngles[1] = inAngle;
+    keys.inWeights[1] = inWeight;
+}
+
+
+// The segment passes through the points of the cubic Bezier with
+// control points a third of each tangent away from the keys. A
+// tangent reaching past the other key is shortened to the segment,
+// keeping its angle.
+void testWeightedSegmentMatchesBezier(double outAngle,
+                                      double outWeight,
+                                      double inAngle,
+                                      double inWeight) {
+    CurveKeys keys;
+    makeWeightedSegment(outAngle, outWeight, inAngle, inWeight, keys);
+    const double toRadians = M_PI / 180.0;
+    double fps = keys.framesPerSecond;
+    double t0 = keys.times[0];
+    double t3 = keys.times[1];
+    double v0 = keys.values[0];
+    double v3 = keys.values[1];
+    double dt = t3 - t0;
+    double outTime = std::min(outWeight * std::cos(outAngle * toRadians) * fps / 3.0, dt);
+    double inTime = std::min(inWeight * std::cos(inAngle * toRadians) * fps / 3.0, dt);
+    double t1 = t0 + outTime;
+    double v1 = v0 + (outTime * std::tan(outAngle * toRadians) / fps);
+    double t2 = t3 - inTime;
+    double v2 = v3 - (inTime * std::tan(inAngle * toRadians) / fps);
+
+    for (int i = 0; i <= 64; ++i) {
+        double s = double(i) / 64.0;
+        double r = 1.0 - s;
+        double t = (r * r * r * t0) + (3.0 * r * r * s * t1) + (3.0 * r * s * s * t2) + (s * s * s * t3);
+        double v = (r * r * r * v0) + (3.0 * r * r * s * v1) + (3.0 * r * s * s * v2) + (s * s * s * v3);
+        CHECK_NEAR(evaluateWeightedCurveSegment(keys, 0, t), v, 1.0e-6);
+        CHECK_NEAR(evaluateCurve(keys, t), v, 1.0e-6);
+    }
+}
+
+
+// Converting a curve to weighted does not change its shape.
+void testMakeWeightedKeepsShape() {
+    CurveKeys keys;
+    keys.resize(6);
+    double times[6] = {0.0, 3.0, 4.5, 12.0, 13.0, 30.0};
+    for (unsigned int k = 0; k < 6; ++k) {
+        keys.times[k] = times[k];
+        keys.values[k] = std::sin(double(k)) * 5.0;
+        keys.inAngles[k] = -40.0 + (17.0 * double(k));
+        keys.outAngles[k] = 60.0 - (23.0 * double(k));
+    }
+    keys.preInfinity = kInfinityLinear;
+    keys.postInfinity = kInfinityLinear;
+    CurveKeys weightedKeys = keys;
+    makeCurveKeysWeighted(weightedKeys);
+    CHECK(weightedKeys.weighted);
+    for (unsigned int k = 0; k < 6; ++k) {
+        CHECK(weightedKeys.inWeights[k] > 0.0);
+        CHECK(weightedKeys.outWeights[k] > 0.0);
+    }
+    for (double t = -5.0; t <= 35.0; t += 0.25) {
+        CHECK_NEAR(evaluateCurve(weightedKeys, t), evaluateCurve(keys, t), 1.0e-8);
+    }
+}
+
+
+// Solving tangent weights on an unweighted destination converts it
+// and gets closer to a weighted source than the unweighted solve.
+void testSolveTangentWeights() {
+    CurveKeys srcKeys;
+    srcKeys.resize(3);
+    srcKeys.weighted = true;
+    double times[3] = {1.0, 20.0, 41.0};
+    double values[3] = {0.0, 5.0, -2.0};
+    double weights[3] = {0.2, 1.4, 0.3};
+    for (unsigned int k = 0; k < 3; ++k) {
+        srcKeys.times[k] = times[k];
+        srcKeys.values[k] = values[k];
+        srcKeys.inAngles[k] = 10.0;
+        srcKeys.outAngles[k] = 10.0;
+        srcKeys.inWeights[k] = weights[k];
+        srcKeys.outWeights[k] = weights[2 - k];
+    }
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    CurveKeys initialKeys;
+    initialKeys.resize(3);
+    initialKeys.times = srcKeys.times;
+
+    CurveKeys hermiteKeys = initialKeys;
+    double hermiteError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, hermiteKeys, options, hermiteError));
+
+    options.adjustTangentWeights = true;
+    CurveKeys weightedKeys = initialKeys;
+    double weightedError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, weightedKeys, options, weightedError));
+    CHECK(weightedKeys.weighted);
+    CHECK(weightedError >= 0.0);
+    CHECK(weightedError <= (hermiteError + 1.0e-9));
+    for (unsigned int k = 0; k < 3; ++k) {
+        CHECK((weightedKeys.inWeights[k] >= kMinTangentWeight) && (weightedKeys.inWeights[k] <= kMaxTangentWeight));
+        CHECK((weightedKeys.outWeights[k] >= kMinTangentWeight) && (weightedKeys.outWeights[k] <= kMaxTangentWeight));
+    }
+}
+
+
+// Cycle repeats the curve, cycle relative also offsets each repeat by
+// the value change of the curve, and oscillate reverses every other
+// repeat. Times on the seams between repeats are not checked, the
+// curve may jump there.
+void testCycledInfinity() {
+    CurveKeys keys;
+    keys.resize(3);
+    double times[3] = {0.0, 4.0, 10.0};
+    double values[3] = {1.0, 5.0, 3.0};
+    for (unsigned int k = 0; k < 3; ++k) {
+        keys.times[k] = times[k];
+        keys.values[k] = values[k];
+        keys.inAngles[k] = 15.0 * double(k);
+        keys.outAngles[k] = -20.0 * double(k);
+    }
+    CurveKeys cycle = keys;
+    cycle.preInfinity = kInfinityCycle;
+    cycle.postInfinity = kInfinityCycle;
+    CurveKeys relative = keys;
+    relative.preInfinity = kInfinityCycleRelative;
+    relative.postInfinity = kInfinityCycleRelative;
+    CurveKeys oscillate = keys;
+    oscillate.preInfinity = kInfinityOscillate;
+    oscillate.postInfinity = kInfinityOscillate;
+    for (double t = 0.25; t < 10.0; t += 0.5) {
+        double v = evaluateCurve(keys, t);
+        CHECK_NEAR(evaluateCurve(cycle, t + 10.0), v, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(cycle, t - 30.0), v, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(relative, t + 20.0), v + 4.0, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(relative, t - 10.0), v - 2.0, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(oscillate, t + 20.0), v, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(oscillate, 20.0 - t), v, 1.0e-9);
+        CHECK_NEAR(evaluateCurve(oscillate, -t), v, 1.0e-9);
+    }
+}
+
+
+// A destination whose cycled infinity reaches into the source range
+// is refused, instead of being solved as if it was constant.
+void testCycledDestinationRefused() {
+    CurveKeys srcKeys;
+    srcKeys.resize(2);
+    srcKeys.times[0] = 0.0;
+    srcKeys.times[1] = 30.0;
+    srcKeys.values[1] = 1.0;
+    CurveKeys dstKeys;
+    dstKeys.resize(2);
+    dstKeys.times[0] = 0.0;
+    dstKeys.times[1] = 20.0;
+    dstKeys.postInfinity = kInfinityCycle;
+
+    SolverOptions options;
+    options.scaleTimeKeys = false;
+    double error = -1.0;
+    CHECK(!solveCurveKeys(srcKeys, dstKeys, options, error));
+
+    // Covering the source range, the infinity is never evaluated.
+    dstKeys.times[1] = 30.0;
+    CHECK(solveCurveKeys(srcKeys, dstKeys, options, error));
+}
+
+
+// Keyframes rounded onto the same frame are moved apart by whole
+// frames, negative times round to the nearest frame (not towards
+// zero), and the fixed keyframes are never crossed.
+void testSnapKeyTimes() {
+    CurveKeys keys;
+    keys.resize(6);
+    double times[6] = {-5.0, -2.6, -2.4, 3.2, 3.4, 9.0};
+    double snapped[6] = {-5.0, -3.0, -2.0, 3.0, 4.0, 9.0};
+    keys.times.assign(times, times + 6);
+    CHECK(snapCurveKeyTimes(keys, 1, 4));
+    for (unsigned int k = 0; k < 6; ++k) {
+        CHECK(keys.times[k] == snapped[k]);
+    }
+
+    // Pushed back from the next fixed keyframe.
+    double crowded[5] = {0.0, 0.9, 1.6, 1.7, 4.0};
+    keys.resize(5);
+    keys.times.assign(crowded, crowded + 5);
+    CHECK(snapCurveKeyTimes(keys, 1, 3));
+    CHECK(keys.times[1] == 1.0);
+    CHECK(keys.times[2] == 2.0);
+    CHECK(keys.times[3] == 3.0);
+
+    // Three keyframes do not fit between frames 0 and 3.
+    keys.times.assign(crowded, crowded + 5);
+    keys.times[4] = 3.0;
+    CHECK(!snapCurveKeyTimes(keys, 1, 3));
+    CHECK(keys.times[2] == crowded[2]);
+}
+
+
+int main() {
+    testWeightedSegmentMatchesBezier(0.0, 0.5, 0.0, 0.5);
+    testWeightedSegmentMatchesBezier(45.0, 0.2, -60.0, 0.4);
+    testWeightedSegmentMatchesBezier(-80.0, 0.05, 80.0, 0.1);
+    testWeightedSegmentMatchesBezier(30.0, 100.0, -20.0, 100.0);
+    testMakeWeightedKeepsShape();
+    testSolveTangentWeights();
+    testCycledInfinity();
+    testCycledDestinationRefused();
+    testSnapKeyTimes();
+    return testResult("testCurve");
+}
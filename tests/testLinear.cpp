@@ -0,0 +1,197 @@
+/*
+ * The banded LDL^T solve matches a dense solve, the linear sample
+ * basis matches the curve evaluation, and the direct solve matches
+ * levmar (with the same error measure).
+ */
+
+// STL
+#include <cmath>     // sin, cos, fabs
+#include <vector>    // vector
+#include <random>    // mt19937, uniform_real_distribution
+
+// Utils
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchLinear.h>
+#include <animCurveMatchSolver.h>
+#include <testUtils.h>
+
+
+// Solve the dense, row-major, 'size' x 'size' system by Gaussian
+// elimination with partial pivoting.
+void solveDense(std::vector<double> matrix, int size, std::vector<double> &rhs) {
+    for (int j = 0; j < size; ++j) {
+        int pivot = j;
+        for (int i = j + 1; i < size; ++i) {
+            if (fabs(matrix[(i * size) + j]) > fabs(matrix[(pivot * size) + j])) {
+                pivot = i;
+            }
+        }
+        for (int k = 0; k < size; ++k) {
+            std::swap(matrix[(j * size) + k], matrix[(pivot * size) + k]);
+        }
+        std::swap(rhs[j], rhs[pivot]);
+        for (int i = j + 1; i < size; ++i) {
+            double factor = matrix[(i * size) + j] / matrix[(j * size) + j];
+            for (int k = j; k < size; ++k) {
+                matrix[(i * size) + k] -= factor * matrix[(j * size) + k];
+            }
+            rhs[i] -= factor * rhs[j];
+        }
+    }
+    for (int i = size - 1; i >= 0; --i) {
+        for (int k = i + 1; k < size; ++k) {
+            rhs[i] -= matrix[(i * size) + k] * rhs[k];
+        }
+        rhs[i] /= matrix[(i * size) + i];
+    }
+}
+
+
+// A random symmetric positive definite band matrix, B^T B + I with a
+// banded B, stored both banded and dense.
+void makeBandedSystem(int size,
+                      int band,
+                      unsigned int seed,
+                      BandedMatrix &banded,
+                      std::vector<double> &dense) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> random(-1.0, 1.0);
+    int halfBand = band / 2;
+    std::vector<double> b(size * size, 0.0);
+    for (int i = 0; i < size; ++i) {
+        for (int j = std::max(0, i - halfBand); j <= std::min(size - 1, i + halfBand); ++j) {
+            b[(i * size) + j] = random(generator);
+        }
+    }
+    banded.resize(size, band);
+    dense.assign(size * size, 0.0);
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            double sum = (i == j) ? 1.0 : 0.0;
+            for (int k = 0; k < size; ++k) {
+                sum += b[(k * size) + i] * b[(k * size) + j];
+            }
+            dense[(i * size) + j] = sum;
+            if ((j >= i) && (j <= (i + band))) {
+                banded.at(i, j) = sum;
+            }
+        }
+    }
+}
+
+
+void testBandedMatchesDense(int size, int band, unsigned int seed) {
+    BandedMatrix banded;
+    std::vector<double> dense;
+    makeBandedSystem(size, band, seed, banded, dense);
+
+    std::vector<double> rhs(size);
+    for (int i = 0; i < size; ++i) {
+        rhs[i] = std::sin(double(i) * 0.7) + 0.5;
+    }
+    std::vector<double> expected = rhs;
+    solveDense(dense, size, expected);
+
+    CHECK(factorBandedLDLT(banded));
+    std::vector<double> result = rhs;
+    solveBandedLDLT(banded, result);
+    for (int i = 0; i < size; ++i) {
+        CHECK_NEAR(result[i], expected[i], 1.0e-9 * (1.0 + fabs(expected[i])));
+    }
+}
+
+
+void testSingularMatrix() {
+    BandedMatrix banded;
+    banded.resize(4, 2);
+    banded.at(0, 0) = 1.0;
+    banded.at(1, 1) = 1.0;
+    banded.at(2, 2) = 0.0;
+    banded.at(3, 3) = 1.0;
+    CHECK(!factorBandedLDLT(banded));
+}
+
+
+void testSampleBasisMatchesCurve(int infinity) {
+    CurveKeys keys;
+    keys.resize(5);
+    keys.preInfinity = infinity;
+    keys.postInfinity = infinity;
+    double times[5] = {1.0, 4.0, 10.0, 11.5, 20.0};
+    for (unsigned int k = 0; k < 5; ++k) {
+        keys.times[k] = times[k];
+        keys.values[k] = std::cos(double(k) * 1.3) * 4.0;
+        keys.inAngles[k] = 20.0 * double(k) - 30.0;
+        keys.outAngles[k] = 45.0 - 15.0 * double(k);
+    }
+    std::vector<double> unknowns;
+    getCurveUnknowns(keys, unknowns);
+
+    int indices[4];
+    double coeffs[4];
+    for (double t = -3.0; t <= 24.0; t += 0.25) {
+        int numTerms = curveSampleBasis(keys, t, indices, coeffs);
+        double value = 0.0;
+        for (int i = 0; i < numTerms; ++i) {
+            CHECK((indices[i] >= 0) && (indices[i] < (int) unknowns.size()));
+            value += coeffs[i] * unknowns[indices[i]];
+        }
+        CHECK_NEAR(value, evaluateCurve(keys, t), 1.0e-9);
+    }
+}
+
+
+// With fixed key times, the direct solve and levmar find the same
+// curve, and both return the RMS sample error.
+void testDirectSolveMatchesLevmar() {
+    CurveKeys srcKeys;
+    CurveKeys initialKeys;
+    makeTestCurve(30, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(5, 1.0, 30.0, initialKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.directSolve = true;
+    CurveKeys directKeys = initialKeys;
+    double directError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, directKeys, options, directError));
+
+    options.directSolve = false;
+    CurveKeys levmarKeys = initialKeys;
+    double levmarError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, levmarKeys, options, levmarError));
+
+    CHECK(directError >= 0.0);
+    CHECK(directError <= (levmarError + 1.0e-6));
+    CHECK_NEAR(directError, levmarError, 1.0e-3);
+    for (double t = 1.0; t <= 30.0; t += 1.0) {
+        CHECK_NEAR(evaluateCurve(directKeys, t), evaluateCurve(levmarKeys, t), 1.0e-2);
+    }
+
+    // The returned error is the RMS of the differences at the samples.
+    ErrorReport report;
+    double reportError = -1.0;
+    directKeys = initialKeys;
+    options.directSolve = true;
+    CHECK(solveCurveKeys(srcKeys, directKeys, options, reportError, &report));
+    double sumSquares = 0.0;
+    for (size_t i = 0; i < report.sampleErrors.size(); ++i) {
+        sumSquares += report.sampleErrors[i] * report.sampleErrors[i];
+    }
+    CHECK(!report.sampleErrors.empty());
+    CHECK_NEAR(reportError, std::sqrt(sumSquares / double(report.sampleErrors.size())), 1.0e-9);
+}
+
+
+int main() {
+    testBandedMatchesDense(1, 4, 1);
+    testBandedMatchesDense(12, 4, 2);
+    testBandedMatchesDense(60, 4, 3);
+    testBandedMatchesDense(30, 7, 4);
+    testSingularMatrix();
+    testSampleBasisMatchesCurve(kInfinityConstant);
+    testSampleBasisMatchesCurve(kInfinityLinear);
+    testDirectSolveMatchesLevmar();
+    return testResult("testLinear");
+}
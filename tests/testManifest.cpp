@@ -0,0 +1,227 @@
+/*
+ * Job manifests and result files read back exactly what was written,
+ * including non-finite numbers, and truncated or corrupt files are
+ * detected.
+ */
+
+// STL
+#include <cmath>     // sin, isnan, isinf
+#include <cstdio>    // remove
+#include <limits>    // numeric_limits
+#include <string>    // string
+#include <vector>    // vector
+#include <fstream>   // ifstream, ofstream
+#include <sstream>   // stringstream
+
+// Utils
+#include <animCurveMatchManifest.h>
+#include <testUtils.h>
+
+
+const char kTestManifestPath[] = "testManifest.acm";
+const char kTestResultsPath[] = "testManifest.acr";
+
+
+void makeKeys(unsigned int numKeys, double offset, CurveKeys &keys) {
+    makeTestCurve(numKeys, 1.0 + offset, 3.0, 1.0 / 3.0, keys);
+    keys.framesPerSecond = 30.0;
+    keys.preInfinity = kInfinityLinear;
+    keys.postInfinity = kInfinityCycle;
+    for (unsigned int k = 0; k < numKeys; ++k) {
+        keys.inWeights[k] = 1.0 / 7.0;
+        keys.outWeights[k] = 1.0e-5;
+    }
+}
+
+
+void checkKeysEqual(const CurveKeys &a, const CurveKeys &b) {
+    CHECK(a.numKeys() == b.numKeys());
+    CHECK(a.framesPerSecond == b.framesPerSecond);
+    CHECK(a.preInfinity == b.preInfinity);
+    CHECK(a.postInfinity == b.postInfinity);
+    CHECK(a.weighted == b.weighted);
+    if (a.numKeys() != b.numKeys()) {
+        return;
+    }
+    for (unsigned int k = 0; k < a.numKeys(); ++k) {
+        CHECK(a.times[k] == b.times[k]);
+        CHECK(a.values[k] == b.values[k]);
+        CHECK(a.inAngles[k] == b.inAngles[k]);
+        CHECK(a.outAngles[k] == b.outAngles[k]);
+        CHECK(a.inWeights[k] == b.inWeights[k]);
+        CHECK(a.outWeights[k] == b.outWeights[k]);
+    }
+}
+
+
+void makeJobs(std::vector<CurveJob> &jobs) {
+    jobs.resize(2);
+    CurveJob &keysJob = jobs[0];
+    keysJob.dstCurveName = "pCube1_translateX";
+    makeKeys(12, 0.0, keysJob.srcKeys);
+    makeKeys(4, 0.5, keysJob.dstKeys);
+    keysJob.options.iterMax = 77;
+    keysJob.options.adjustTimes = true;
+    keysJob.options.restarts = 3;
+    keysJob.options.timeBudget = 0.25;
+    keysJob.options.keyRanges.push_back(0);
+    keysJob.options.keyRanges.push_back(1);
+    keysJob.options.keyRanges.push_back(3);
+    keysJob.options.keyRanges.push_back(3);
+
+    CurveJob &samplesJob = jobs[1];
+    samplesJob.dstCurveName = "pCube1_rotateY";
+    for (int i = 0; i < 20; ++i) {
+        samplesJob.srcSamples.times.push_back(double(i) + 0.5);
+        samplesJob.srcSamples.values.push_back(std::sin(double(i) * 0.1));
+    }
+    makeKeys(3, 0.0, samplesJob.dstKeys);
+    samplesJob.sweep = true;
+    samplesJob.tolerance = 0.125;
+    samplesJob.minKeys = 3;
+    samplesJob.maxKeys = 9;
+    samplesJob.framesPerSecond = 30.0;
+}
+
+
+void testManifestRoundTrip() {
+    std::vector<CurveJob> jobs;
+    makeJobs(jobs);
+    std::remove(kTestManifestPath);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        CHECK(appendManifestJob(kTestManifestPath, jobs[i]));
+    }
+
+    std::vector<CurveJob> readJobs;
+    CHECK(readManifest(kTestManifestPath, readJobs));
+    CHECK(readJobs.size() == jobs.size());
+    for (size_t i = 0; (i < jobs.size()) && (i < readJobs.size()); ++i) {
+        const CurveJob &job = jobs[i];
+        const CurveJob &readJob = readJobs[i];
+        CHECK(readJob.dstCurveName == job.dstCurveName);
+        checkKeysEqual(readJob.srcKeys, job.srcKeys);
+        checkKeysEqual(readJob.dstKeys, job.dstKeys);
+        CHECK(readJob.srcSamples.times == job.srcSamples.times);
+        CHECK(readJob.srcSamples.values == job.srcSamples.values);
+        CHECK(readJob.options.iterMax == job.options.iterMax);
+        CHECK(readJob.options.adjustTimes == job.options.adjustTimes);
+        CHECK(readJob.options.restarts == job.options.restarts);
+        CHECK(readJob.options.timeBudget == job.options.timeBudget);
+        CHECK(readJob.options.keyRanges == job.options.keyRanges);
+        CHECK(readJob.sweep == job.sweep);
+        CHECK(readJob.tolerance == job.tolerance);
+        CHECK(readJob.minKeys == job.minKeys);
+        CHECK(readJob.maxKeys == job.maxKeys);
+        CHECK(readJob.framesPerSecond == job.framesPerSecond);
+    }
+    std::remove(kTestManifestPath);
+}
+
+
+// Non-finite keyframe numbers are read back, and a non-finite error is
+// written as the "no error" value.
+void testResultsNonFinite() {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<JobResult> results(3);
+    double errors[3] = {0.5, nan, inf};
+    for (unsigned int i = 0; i < 3; ++i) {
+        results[i].index = i;
+        results[i].solved = i == 0;
+        results[i].job.dstCurveName = "curve" + std::to_string(i);
+        results[i].job.error = errors[i];
+        makeKeys(3, double(i), results[i].job.dstKeys);
+    }
+    results[1].job.dstKeys.values[1] = nan;
+    results[2].job.dstKeys.inAngles[0] = -inf;
+    CHECK(writeResultsFile(kTestResultsPath, results));
+
+    std::vector<JobResult> readResults;
+    CHECK(readResultsFile(kTestResultsPath, readResults));
+    CHECK(readResults.size() == 3);
+    if (readResults.size() == 3) {
+        CHECK(readResults[0].job.error == 0.5);
+        CHECK(readResults[1].job.error == -1.0);
+        CHECK(readResults[2].job.error == -1.0);
+        CHECK(readResults[0].solved);
+        CHECK(!readResults[1].solved);
+        CHECK(readResults[2].index == 2);
+        CHECK(readResults[2].job.dstCurveName == "curve2");
+        CHECK(std::isnan(readResults[1].job.dstKeys.values[1]));
+        CHECK(std::isinf(readResults[2].job.dstKeys.inAngles[0]));
+        CHECK(readResults[2].job.dstKeys.inAngles[0] < 0.0);
+        checkKeysEqual(readResults[0].job.dstKeys, results[0].job.dstKeys);
+    }
+    std::remove(kTestResultsPath);
+}
+
+
+// A results file cut short keeps the complete results before the cut.
+void testTruncatedResults() {
+    std::vector<JobResult> results(2);
+    for (unsigned int i = 0; i < 2; ++i) {
+        results[i].index = i;
+        results[i].solved = true;
+        results[i].job.dstCurveName = "curve";
+        results[i].job.error = 0.25;
+        makeKeys(5, 0.0, results[i].job.dstKeys);
+    }
+    std::stringstream stream;
+    stream << std::setprecision(kManifestPrecision);
+    for (unsigned int i = 0; i < 2; ++i) {
+        writeJobResult(stream, results[i].index, results[i].solved, results[i].job);
+    }
+    std::string text = stream.str();
+    std::stringstream truncated(text.substr(0, text.size() - 20));
+
+    std::vector<JobResult> readResults;
+    CHECK(!readJobResults(truncated, readResults));
+    CHECK(readResults.size() == 1);
+}
+
+
+// A corrupt keyframe or sample count is refused, instead of being
+// allocated.
+void testCorruptCounts() {
+    std::stringstream keysStream("keys 4000000000 24 0 0 0\n1 2 3 4 5 6\n");
+    CurveKeys keys;
+    CHECK(!readManifestKeys(keysStream, keys));
+    CHECK(keys.numKeys() == 0);
+
+    std::stringstream samplesStream("samples 4000000000\n1 2\n");
+    CurveSamples samples;
+    CHECK(!readManifestSamples(samplesStream, samples));
+    CHECK(samples.numSamples() == 0);
+
+    // The same in a manifest file.
+    std::vector<CurveJob> jobs;
+    makeJobs(jobs);
+    std::remove(kTestManifestPath);
+    CHECK(appendManifestJob(kTestManifestPath, jobs[0]));
+    std::string text;
+    {
+        std::ifstream file(kTestManifestPath);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        text = buffer.str();
+    }
+    size_t pos = text.find("keys 12 ");
+    CHECK(pos != std::string::npos);
+    if (pos != std::string::npos) {
+        text.replace(pos, 8, "keys 4000000000 ");
+        std::ofstream file(kTestManifestPath);
+        file << text;
+    }
+    std::vector<CurveJob> readJobs;
+    CHECK(!readManifest(kTestManifestPath, readJobs));
+    std::remove(kTestManifestPath);
+}
+
+
+int main() {
+    testManifestRoundTrip();
+    testResultsNonFinite();
+    testTruncatedResults();
+    testCorruptCounts();
+    return testResult("testManifest");
+}
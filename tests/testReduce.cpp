@@ -0,0 +1,55 @@
+/*
+ * Keyframe reduction stays within its tolerance on every frame, not
+ * only at the source keyframes.
+ */
+
+// STL
+#include <cmath>     // fabs
+
+// Utils
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchReduce.h>
+#include <testUtils.h>
+
+
+void testReduceWithinTolerance(double tolerance) {
+    CurveKeys srcKeys;
+    makeTestCurve(200, 1.0, 3.0, 1.0, srcKeys);
+    CurveKeys dstKeys;
+    reduceCurveKeys(srcKeys, tolerance, NULL, dstKeys);
+
+    unsigned int numKeys = dstKeys.numKeys();
+    CHECK(numKeys >= 2);
+    CHECK(numKeys < srcKeys.numKeys());
+    CHECK_NEAR(dstKeys.times[0], srcKeys.times[0], 0.0);
+    CHECK_NEAR(dstKeys.times[numKeys - 1], srcKeys.times[srcKeys.numKeys() - 1], 0.0);
+
+    double maxError = 0.0;
+    double start = srcKeys.times[0];
+    double end = srcKeys.times[srcKeys.numKeys() - 1];
+    for (double t = start; t <= end; t += 1.0) {
+        maxError = std::max(maxError, fabs(evaluateCurve(srcKeys, t) - evaluateCurve(dstKeys, t)));
+    }
+    CHECK(maxError <= (tolerance * (1.0 + 1.0e-6)));
+}
+
+
+// A looser tolerance never needs more keyframes.
+void testReduceTolerancesOrdered() {
+    CurveKeys srcKeys;
+    makeTestCurve(200, 1.0, 3.0, 1.0, srcKeys);
+    CurveKeys tightKeys;
+    CurveKeys looseKeys;
+    reduceCurveKeys(srcKeys, 0.001, NULL, tightKeys);
+    reduceCurveKeys(srcKeys, 0.1, NULL, looseKeys);
+    CHECK(looseKeys.numKeys() <= tightKeys.numKeys());
+}
+
+
+int main() {
+    testReduceWithinTolerance(0.001);
+    testReduceWithinTolerance(0.01);
+    testReduceWithinTolerance(0.1);
+    testReduceTolerancesOrdered();
+    return testResult("testReduce");
+}
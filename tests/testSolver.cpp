@@ -0,0 +1,464 @@
+/*
+ * The streamed Levenberg-Marquardt solve finds the same curve as the
+ * direct solve, and matches levmar when key times are solved too.
+ * Key times solved on whole frames stay whole frames, the cached
+ * residuals match a full evaluation, curves solve the same in any
+ * value units, solves stop early at their target error or time
+ * budget, and the error report matches re-sampling the solved curve
+ * and holds the covariance of the solved keyframes.
+ */
+
+// STL
+#include <cmath>     // fabs, floor, sqrt, isfinite
+#include <cstdlib>   // abs
+#include <limits>    // numeric_limits
+#include <algorithm> // max
+#include <vector>    // vector
+#include <random>    // mt19937, uniform_int_distribution, uniform_real_distribution
+
+// Utils
+#include <animCurveMatchCurve.h>
+#include <animCurveMatchSolver.h>
+#include <testUtils.h>
+
+
+void testStreamedMatchesDirect() {
+    CurveKeys srcKeys;
+    CurveKeys initialKeys;
+    makeTestCurve(400, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(24, 1.0, 400.0, initialKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.forceWholeFrames = false;
+
+    options.directSolve = true;
+    CurveKeys directKeys = initialKeys;
+    double directError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, directKeys, options, directError));
+
+    options.directSolve = false;
+    options.streamed = true;
+    CurveKeys streamedKeys = initialKeys;
+    double streamedError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, streamedKeys, options, streamedError));
+
+    // The direct solve is the exact least squares minimum.
+    CHECK(directError >= 0.0);
+    CHECK(streamedError >= (directError - 1.0e-9));
+    CHECK_NEAR(streamedError, directError, 1.0e-4 + (1.0e-2 * directError));
+    for (double t = 1.0; t <= 400.0; t += 1.0) {
+        CHECK_NEAR(evaluateCurve(streamedKeys, t), evaluateCurve(directKeys, t), 1.0e-2);
+    }
+}
+
+
+// With key times solved as well, the streamed solve gets (about) as
+// close as levmar with a full Jacobian.
+void testStreamedMatchesLevmar() {
+    CurveKeys srcKeys;
+    CurveKeys initialKeys;
+    makeTestCurve(120, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(8, 1.0, 120.0, initialKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.forceWholeFrames = false;
+    options.adjustTimes = true;
+    options.directSolve = false;
+
+    CurveKeys levmarKeys = initialKeys;
+    double levmarError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, levmarKeys, options, levmarError));
+
+    options.streamed = true;
+    CurveKeys streamedKeys = initialKeys;
+    double streamedError = -1.0;
+    CHECK(solveCurveKeys(srcKeys, streamedKeys, options, streamedError));
+
+    CHECK(levmarError >= 0.0);
+    CHECK(streamedError >= 0.0);
+    CHECK(streamedError <= ((levmarError * 1.5) + 1.0e-4));
+    for (unsigned int k = 1; k < streamedKeys.numKeys(); ++k) {
+        CHECK(streamedKeys.times[k] > streamedKeys.times[k - 1]);
+    }
+}
+
+
+// Solving key times on whole frames gives whole, increasing frames,
+// also for keyframes starting inside the same frame and at negative
+// times.
+void testWholeFrameTimes() {
+    CurveKeys srcKeys;
+    makeTestCurve(81, -40.0, 1.0, 1.0, srcKeys);
+    CurveKeys dstKeys;
+    dstKeys.resize(6);
+    double times[6] = {-40.0, -20.4, -20.2, 3.3, 3.45, 40.0};
+    dstKeys.times.assign(times, times + 6);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.adjustTimes = true;
+    options.forceWholeFrames = true;
+    double error = -1.0;
+    CHECK(solveCurveKeys(srcKeys, dstKeys, options, error));
+    CHECK(error >= 0.0);
+    for (unsigned int k = 0; k < dstKeys.numKeys(); ++k) {
+        CHECK(dstKeys.times[k] == std::floor(dstKeys.times[k]));
+        if (k > 0) {
+            CHECK(dstKeys.times[k] > dstKeys.times[k - 1]);
+        }
+    }
+    CHECK(dstKeys.times[0] == -40.0);
+    CHECK(dstKeys.times[5] == 40.0);
+}
+
+
+// Solver data matching 'dstKeys' to the samples, with every keyframe
+// and parameter solved (weights only of a weighted curve).
+void makeCurveData(const std::vector<double> &sampleTimes,
+                   const std::vector<double> &srcValues,
+                   CurveKeys &dstKeys,
+                   CurveData &userData) {
+    userData.sampleTimes = &sampleTimes;
+    userData.srcValues = &srcValues;
+    userData.dstKeys = &dstKeys;
+    userData.firstKey = 0;
+    userData.lastKey = (int) dstKeys.numKeys() - 1;
+    userData.minKeyTime = sampleTimes.front();
+    userData.maxKeyTime = sampleTimes.back();
+    userData.adjustValues = true;
+    userData.adjustTimes = true;
+    userData.adjustTangentAngles = true;
+    userData.adjustTangentWeights = dstKeys.weighted;
+    userData.forceWholeFrames = false;
+    userData.addKeys = false;
+    userData.streamed = false;
+    userData.cancel = NULL;
+    userData.deadline = 0;
+    userData.targetRmsError = 0.0;
+    userData.targetMaxError = 0.0;
+    userData.stopped = false;
+    userData.bestError = std::numeric_limits<double>::max();
+    setCurveParameterScales(userData, sampleTimes.front(), sampleTimes.back());
+    invalidateResidualCache(userData);
+}
+
+
+// After random single parameter changes (as levmar makes them for the
+// Jacobian), the cached residuals are the same as evaluating every
+// sample. The destination reaches past both ends of the samples, so
+// the end keyframes extrapolate and some keyframes have no samples.
+void testResidualCacheMatchesFullEvaluation() {
+    CurveKeys srcKeys;
+    makeTestCurve(51, 0.0, 1.0, 1.0, srcKeys);
+    std::vector<double> sampleTimes;
+    std::vector<double> srcValues;
+    for (double t = 0.0; t <= 50.0; t += 0.5) {
+        sampleTimes.push_back(t);
+        srcValues.push_back(evaluateCurve(srcKeys, t));
+    }
+    CurveKeys dstKeys;
+    makeTestKeyTimes(9, -20.0, 76.0, dstKeys);
+    dstKeys.weighted = true;
+    dstKeys.preInfinity = kInfinityLinear;
+    dstKeys.postInfinity = kInfinityLinear;
+    int numKeys = (int) dstKeys.numKeys();
+    int m = numKeys * kParamsPerKey;
+
+    CurveData userData;
+    makeCurveData(sampleTimes, srcValues, dstKeys, userData);
+    userData.minKeyTime = -30.0;
+    userData.maxKeyTime = 90.0;
+    updateResidualCache(userData);
+
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> randomParam(0, m - 1);
+    std::uniform_real_distribution<double> randomStep(-2.0, 2.0);
+    std::vector<double> params(m);
+    int numPartial = 0;
+    for (int iteration = 0; iteration < 500; ++iteration) {
+        getCurveParameters(dstKeys, 0, numKeys - 1, &params[0]);
+        int i = randomParam(random);
+        params[i] += randomStep(random) * ((i % kParamsPerKey) == 0 ? 3.0 : 1.0);
+        setCurveParameters(&params[0], m, &userData);
+        if (updateResidualCache(userData) < (int) sampleTimes.size()) {
+            numPartial += 1;
+        }
+        for (size_t j = 0; j < sampleTimes.size(); ++j) {
+            double residual = sampleResidual(srcValues[j], evaluateCurve(dstKeys, sampleTimes[j]));
+            CHECK(userData.cacheResidual[j] == residual);
+        }
+    }
+    CHECK(numPartial > 250);
+
+    // Keyframes changed outside of the parameters are marked.
+    dstKeys.values[0] += 1.0;
+    dstKeys.values[numKeys - 1] -= 1.0;
+    markCurveKeysChanged(userData, 0, 0);
+    markCurveKeysChanged(userData, numKeys - 1, numKeys - 1);
+    updateResidualCache(userData);
+    for (size_t j = 0; j < sampleTimes.size(); ++j) {
+        double residual = sampleResidual(srcValues[j], evaluateCurve(dstKeys, sampleTimes[j]));
+        CHECK(userData.cacheResidual[j] == residual);
+    }
+    CHECK(updateResidualCache(userData) == 0);
+}
+
+
+// Solve the source values multiplied by 'scale', with levmar or
+// streamed. Returns the RMS error relative to the scale, and the
+// number of iterations in 'iterations'.
+double solveScaledCurve(double scale, bool streamed, int &iterations) {
+    CurveKeys srcKeys;
+    makeTestCurve(120, 1.0, 1.0, scale, srcKeys);
+    std::vector<double> sampleTimes;
+    std::vector<double> srcValues;
+    for (unsigned int k = 0; k < srcKeys.numKeys(); ++k) {
+        sampleTimes.push_back(srcKeys.times[k]);
+        srcValues.push_back(srcKeys.values[k]);
+    }
+    CurveKeys dstKeys;
+    makeTestKeyTimes(8, 1.0, 120.0, dstKeys);
+
+    CurveData userData;
+    makeCurveData(sampleTimes, srcValues, dstKeys, userData);
+    userData.streamed = streamed;
+    int m = (int) dstKeys.numKeys() * kParamsPerKey;
+    int n = (int) sampleTimes.size();
+    std::vector<double> params(m);
+    getCurveParameters(dstKeys, 0, userData.lastKey, &params[0]);
+    double info[LM_INFO_SZ];
+    int ret = runCurveSolve(userData, &params[0], m, n, 1000, kInitialMu, info);
+    CHECK(ret != -1);
+    iterations = (int) info[5];
+    return rmsError(info[1], n) / scale;
+}
+
+
+// The parameters are solved scaled, so curves in very small or very
+// large units solve the same way, with the same relative error.
+void testScaleInvariance() {
+    for (int streamed = 0; streamed < 2; ++streamed) {
+        int iterations = 0;
+        int smallIterations = 0;
+        int largeIterations = 0;
+        double error = solveScaledCurve(1.0, streamed != 0, iterations);
+        double smallError = solveScaledCurve(0.01, streamed != 0, smallIterations);
+        double largeError = solveScaledCurve(10000.0, streamed != 0, largeIterations);
+        CHECK(error < 0.01);
+        CHECK_NEAR(smallError, error, 1.0e-3 * error);
+        CHECK_NEAR(largeError, error, 1.0e-3 * error);
+
+        // The last iterations only gain rounding errors, so the counts
+        // are close rather than equal.
+        int maxDifference = std::max(2, iterations / 5);
+        CHECK(iterations > 0);
+        CHECK(abs(smallIterations - iterations) <= maxDifference);
+        CHECK(abs(largeIterations - iterations) <= maxDifference);
+    }
+}
+
+
+// Maximum absolute sample error of a solve, from its report.
+double reportMaxError(const ErrorReport &report) {
+    double maxError = 0.0;
+    for (size_t i = 0; i < report.sampleErrors.size(); ++i) {
+        maxError = std::max(maxError, report.sampleErrors[i]);
+    }
+    return maxError;
+}
+
+
+// A solve stops once the maximum sample error is within the target,
+// before it would have converged.
+void testTargetMaxError() {
+    CurveKeys srcKeys;
+    CurveKeys initialKeys;
+    makeTestCurve(120, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(8, 1.0, 120.0, initialKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.forceWholeFrames = false;
+    options.adjustTimes = true;
+    options.directSolve = false;
+    CurveKeys fullKeys = initialKeys;
+    double fullError = -1.0;
+    ErrorReport fullReport;
+    CHECK(solveCurveKeys(srcKeys, fullKeys, options, fullError, &fullReport));
+
+    const double target = 0.1;
+    CHECK(reportMaxError(fullReport) < target);
+    options.targetMaxError = target;
+    CurveKeys targetKeys = initialKeys;
+    double targetError = -1.0;
+    ErrorReport targetReport;
+    CHECK(solveCurveKeys(srcKeys, targetKeys, options, targetError, &targetReport));
+    CHECK(reportMaxError(targetReport) <= target);
+    CHECK(targetError > fullError);
+}
+
+
+// With a time budget too small for a single iteration, the solve still
+// returns the best keyframes it has evaluated, never worse than the
+// keyframes it started from.
+void testTinyTimeBudget() {
+    CurveKeys srcKeys;
+    CurveKeys initialKeys;
+    makeTestCurve(120, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(8, 1.0, 120.0, initialKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.forceWholeFrames = false;
+    options.adjustTimes = true;
+    options.directSolve = false;
+    options.timeBudget = 1.0e-9;
+    for (int streamed = 0; streamed < 2; ++streamed) {
+        options.streamed = streamed != 0;
+        CurveKeys dstKeys = initialKeys;
+        double error = -1.0;
+        ErrorReport report;
+        CHECK(solveCurveKeys(srcKeys, dstKeys, options, error, &report));
+        CHECK(std::isfinite(error));
+        CHECK(error >= 0.0);
+
+        // The returned error is that of the returned keyframes.
+        double initialSquares = 0.0;
+        double sumSquares = 0.0;
+        for (size_t i = 0; i < report.sampleTimes.size(); ++i) {
+            double t = report.sampleTimes[i];
+            double x = evaluateCurve(srcKeys, t) - evaluateCurve(initialKeys, t);
+            double y = evaluateCurve(srcKeys, t) - evaluateCurve(dstKeys, t);
+            initialSquares += x * x;
+            sumSquares += y * y;
+        }
+        double numSamples = double(report.sampleTimes.size());
+        CHECK_NEAR(error, std::sqrt(sumSquares / numSamples), 1.0e-9);
+        CHECK(error <= (std::sqrt(initialSquares / numSamples) * (1.0 + 1.0e-9)));
+        for (unsigned int k = 0; k < dstKeys.numKeys(); ++k) {
+            CHECK(std::isfinite(dstKeys.values[k]));
+            CHECK(std::isfinite(dstKeys.times[k]));
+        }
+    }
+}
+
+
+// The report's sample and segment errors are the same as re-sampling
+// the solved curve. The destination starts after the source, so the
+// samples before its first keyframe count towards the first segment.
+void testErrorReportSegments() {
+    CurveKeys srcKeys;
+    CurveKeys dstKeys;
+    makeTestCurve(120, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(6, 10.0, 120.0, dstKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    double error = -1.0;
+    ErrorReport report;
+    CHECK(solveCurveKeys(srcKeys, dstKeys, options, error, &report));
+
+    int numSegments = (int) dstKeys.numKeys() - 1;
+    CHECK(report.error == error);
+    CHECK(!report.sampleTimes.empty());
+    CHECK(report.sampleErrors.size() == report.sampleTimes.size());
+    CHECK((int) report.segmentMaxErrors.size() == numSegments);
+    CHECK((int) report.segmentRmsErrors.size() == numSegments);
+    if (((int) report.segmentMaxErrors.size() != numSegments)
+        || ((int) report.segmentRmsErrors.size() != numSegments)
+        || (report.sampleErrors.size() != report.sampleTimes.size())) {
+        return;
+    }
+
+    std::vector<double> maxErrors(numSegments, 0.0);
+    std::vector<double> sumSquares(numSegments, 0.0);
+    std::vector<int> counts(numSegments, 0);
+    int numBefore = 0;
+    for (size_t i = 0; i < report.sampleTimes.size(); ++i) {
+        double t = report.sampleTimes[i];
+        double sampleError = fabs(evaluateCurve(srcKeys, t) - evaluateCurve(dstKeys, t));
+        CHECK_NEAR(report.sampleErrors[i], sampleError, 1.0e-12);
+        int k = 0;
+        while (((k + 1) < numSegments) && (t >= dstKeys.times[k + 1])) {
+            k += 1;
+        }
+        if (t < dstKeys.times[0]) {
+            numBefore += 1;
+        }
+        maxErrors[k] = std::max(maxErrors[k], sampleError);
+        sumSquares[k] += sampleError * sampleError;
+        counts[k] += 1;
+    }
+    CHECK(numBefore > 0);
+    for (int k = 0; k < numSegments; ++k) {
+        CHECK(counts[k] > 0);
+        CHECK_NEAR(report.segmentMaxErrors[k], maxErrors[k], 1.0e-12);
+        CHECK_NEAR(report.segmentRmsErrors[k], std::sqrt(sumSquares[k] / double(std::max(counts[k], 1))), 1.0e-12);
+    }
+}
+
+
+// The covariance has a block per keyframe, and only the solved
+// parameters of the solved keyframes have non-zero rows.
+void testKeyCovariance() {
+    CurveKeys srcKeys;
+    CurveKeys dstKeys;
+    makeTestCurve(120, 1.0, 1.0, 1.0, srcKeys);
+    makeTestKeyTimes(8, 1.0, 120.0, dstKeys);
+
+    SolverOptions options;
+    options.restarts = 0;
+    options.scaleTimeKeys = false;
+    options.covariance = true;
+    options.firstKey = 2;
+    options.lastKey = 4;
+    double error = -1.0;
+    ErrorReport report;
+    CHECK(solveCurveKeys(srcKeys, dstKeys, options, error, &report));
+
+    int numKeys = (int) dstKeys.numKeys();
+    const int blockSize = kParamsPerKey * kParamsPerKey;
+    CHECK((int) report.keyCovariance.size() == (numKeys * blockSize));
+    if ((int) report.keyCovariance.size() != (numKeys * blockSize)) {
+        return;
+    }
+    for (int k = 0; k < numKeys; ++k) {
+        const double *block = &report.keyCovariance[k * blockSize];
+        bool keySolved = (k >= options.firstKey) && (k <= options.lastKey);
+        for (int r = 0; r < kParamsPerKey; ++r) {
+            // Values and tangent angles are solved, times and weights not.
+            bool solved = keySolved && (r >= 1) && (r <= 3);
+            for (int c = 0; c < kParamsPerKey; ++c) {
+                if (!solved) {
+                    CHECK(block[(r * kParamsPerKey) + c] == 0.0);
+                    CHECK(block[(c * kParamsPerKey) + r] == 0.0);
+                }
+            }
+            if (solved) {
+                CHECK(block[(r * kParamsPerKey) + r] > 0.0);
+            }
+        }
+    }
+}
+
+
+int main() {
+    testStreamedMatchesDirect();
+    testStreamedMatchesLevmar();
+    testWholeFrameTimes();
+    testResidualCacheMatchesFullEvaluation();
+    testScaleInvariance();
+    testTargetMaxError();
+    testTinyTimeBudget();
+    testErrorReportSegments();
+    testKeyCovariance();
+    return testResult("testSolver");
+}
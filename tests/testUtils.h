@@ -0,0 +1,77 @@
+/*
+ * Checks and curve fixtures for the Maya independent tests.
+ *
+ * Each test is an executable; failed checks are printed and counted,
+ * and 'testResult' turns the count into the exit code for ctest.
+ */
+
+
+#ifndef MAYA_ANIM_CURVE_MATCH_TEST_UTILS_H
+#define MAYA_ANIM_CURVE_MATCH_TEST_UTILS_H
+
+// STL
+#include <cmath>     // fabs, sin, cos
+#include <iostream>  // cerr, endl
+
+// Utils
+#include <animCurveMatchCurve.h>
+
+
+#define CHECK(x) do { if (!(x)) { std::cerr << __FILE__ << ':' << __LINE__ << " CHECK failed: " << #x << std::endl; ++testFailures(); } } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) do { double checkA = (a); double checkB = (b); if (!(fabs(checkA - checkB) <= (tolerance))) { std::cerr << __FILE__ << ':' << __LINE__ << " CHECK_NEAR failed: " << #a << " = " << checkA << ", " << #b << " = " << checkB << std::endl; ++testFailures(); } } while (0)
+
+
+// Number of failed checks so far.
+inline
+int &testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+
+// Exit code of a test executable.
+inline
+int testResult(const char *name) {
+    if (testFailures() > 0) {
+        std::cerr << name << ": " << testFailures() << " check(s) failed." << std::endl;
+        return 1;
+    }
+    std::cout << name << ": passed." << std::endl;
+    return 0;
+}
+
+
+// A smooth curve with 'numKeys' keyframes, 'spacing' frames apart from
+// 'start'. Values are 'scale' * (3 sin(0.11 t) + cos(0.037 t)), and the
+// tangents follow the curve.
+inline
+void makeTestCurve(unsigned int numKeys,
+                   double start,
+                   double spacing,
+                   double scale,
+                   CurveKeys &keys) {
+    keys.resize(numKeys);
+    for (unsigned int k = 0; k < numKeys; ++k) {
+        double t = start + (double(k) * spacing);
+        double slope = (0.33 * std::cos(t * 0.11)) - (0.037 * std::sin(t * 0.037));
+        keys.times[k] = t;
+        keys.values[k] = scale * ((3.0 * std::sin(t * 0.11)) + std::cos(t * 0.037));
+        keys.inAngles[k] = slopeToAngle(scale * slope, keys.framesPerSecond);
+        keys.outAngles[k] = keys.inAngles[k];
+    }
+}
+
+
+// 'numKeys' flat keyframes at zero, evenly spaced from 'start' to 'end'.
+inline
+void makeTestKeyTimes(unsigned int numKeys, double start, double end, CurveKeys &keys) {
+    keys.resize(numKeys);
+    double step = (end - start) / double(numKeys - 1);
+    for (unsigned int k = 0; k < numKeys; ++k) {
+        keys.times[k] = start + (double(k) * step);
+    }
+}
+
+
+#endif // MAYA_ANIM_CURVE_MATCH_TEST_UTILS_H